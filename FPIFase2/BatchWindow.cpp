@@ -0,0 +1,137 @@
+#include "BatchWindow.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <QVBoxLayout>
+#include "ImageMatrix.hpp"
+
+#define QUEUE_CAPACITY 4
+#define PROCESSORS 2
+#define WINDOW_WIDTH 360
+#define WINDOW_HEIGHT 90
+
+namespace fs = std::filesystem;
+
+static bool IsImagePath(const fs::path &path) {
+    static const char *extensions[] = {".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff", ".webp"};
+    std::string extension = path.extension().string();
+
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    for (const char *known : extensions) {
+        if (extension == known) {return true;}
+    }
+    return false;
+}
+
+// Init:
+BatchWindow::BatchWindow(const Recipe &recipe, const std::string &folder):
+    recipe(recipe), outputFolder((fs::path(folder) / "DuckyShop").string()),
+    decoded(QUEUE_CAPACITY), processed(QUEUE_CAPACITY) {
+    std::error_code error, entryError;
+    fs::directory_iterator entry(folder, error), end;
+
+    // Non-throwing overloads: a dangling link or an unreadable entry is skipped, not fatal
+    for (;!error && entry != end;entry.increment(error)) {
+        if (entry->is_regular_file(entryError) && IsImagePath(entry->path())) {
+            paths.push_back(entry->path().string());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    if (error) {
+        std::cerr << "Failed to list " << folder << std::endl;
+    }
+
+    progressBar = new QProgressBar(this);
+    progressBar->setRange(0, std::max<int>(1, paths.size()));
+    progressBar->setValue(0);
+    statusLabel = new QLabel(this);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(progressBar);
+    layout->addWidget(statusLabel);
+    setWindowTitle("Batch apply");
+    resize(WINDOW_WIDTH, WINDOW_HEIGHT);
+}
+
+BatchWindow::~BatchWindow() {
+    // Unblock every stage, then the pool joins them
+    decoded.Abort();
+    processed.Abort();
+    pool.reset();
+}
+
+void BatchWindow::Start() {
+    std::error_code error;
+    int k;
+
+    start = std::chrono::steady_clock::now();
+    ShowProgress(paths.empty());
+    if (paths.empty()) {return;}
+
+    fs::create_directories(outputFolder, error);
+    pool.reset(new ThreadPool(PROCESSORS + 2));
+    processors = PROCESSORS;
+    pool->Submit([this]() {Decode();});
+    for (k=0;k<PROCESSORS;k++) {
+        pool->Submit([this]() {Process();});
+    }
+    pool->Submit([this]() {Encode();});
+}
+
+// Stages:
+void BatchWindow::Decode() {
+    for (const std::string &path : paths) {
+        Frame frame{path, ReadImage(path)};
+        if (!decoded.Push(std::move(frame))) {break;}
+    }
+    decoded.Close();
+}
+
+void BatchWindow::Process() {
+    Frame frame;
+
+    while (decoded.Pop(frame)) {
+        if (!frame.img.empty()) {
+            recipe.Apply(frame.img, frame.img);
+        }
+        if (!processed.Push(std::move(frame))) {break;}
+    }
+    // The last processor to leave ends the encoder's input
+    if (--processors == 0) {
+        processed.Close();
+    }
+}
+
+void BatchWindow::Encode() {
+    Frame frame;
+
+    while (processed.Pop(frame)) {
+        // JPEG has no alpha, so cut-outs are written as PNG
+        bool png = frame.img.channels() == 4;
+        // The source extension stays in the name, so a.jpg and a.png do not overwrite each other
+        std::string output = (fs::path(outputFolder) / fs::path(frame.path).filename()).string() + (png ? ".png" : ".jpeg");
+        if (frame.img.empty() || !cv::imwrite(output, png ? EncoderDepth(frame.img) : DisplayDepth(frame.img))) {
+            std::cerr << "Failed to process " << frame.path << std::endl;
+            failed++;
+        }
+        finished++;
+        QMetaObject::invokeMethod(this, [this]() {ShowProgress(false);}, Qt::QueuedConnection);
+    }
+    QMetaObject::invokeMethod(this, [this]() {ShowProgress(true);}, Qt::QueuedConnection);
+}
+
+void BatchWindow::ShowProgress(bool done) {
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int count = finished;
+    QString status = QString("%1/%2 images, %3 img/s").arg(count).arg(int(paths.size()))
+                     .arg(seconds > 0 ? count / seconds : 0.0, 0, 'f', 1);
+
+    if (failed > 0) {
+        status += QString(", %1 failed").arg(int(failed));
+    }
+    if (done) {
+        status += paths.empty() ? " (no images found)" : " - done";
+    }
+    progressBar->setValue(count);
+    statusLabel->setText(status);
+}
@@ -0,0 +1,55 @@
+#ifndef BATCHWINDOW_HPP
+#define BATCHWINDOW_HPP
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <QLabel>
+#include <QProgressBar>
+#include <QWidget>
+#include "BoundedQueue.hpp"
+#include "Recipe.hpp"
+#include "ThreadPool.hpp"
+
+/* Non-modal window that replays a recipe over every image of a folder, writing the
+results to a "DuckyShop" subfolder. Decoding, processing and encoding run as
+pipelined stages on a dedicated pool, connected by bounded queues. Closing the
+window cancels the batch. */
+class BatchWindow : public QWidget {
+
+private:
+    struct Frame {
+        std::string path;
+        cv::Mat img;
+    };
+
+    Recipe recipe;
+    std::vector<std::string> paths;
+    std::string outputFolder;
+    QProgressBar *progressBar;
+    QLabel *statusLabel;
+    std::chrono::steady_clock::time_point start;
+    std::atomic<int> finished{0},
+                     failed{0},
+                     processors{0};
+    BoundedQueue<Frame> decoded;
+    BoundedQueue<Frame> processed;
+    std::unique_ptr<ThreadPool> pool;
+
+    void Decode();
+    void Process();
+    void Encode();
+    void ShowProgress(bool done);
+
+public:
+    // Init:
+    BatchWindow(const Recipe &recipe, const std::string &folder);
+    ~BatchWindow();
+
+    void Start();
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef BOUNDEDQUEUE_HPP
+#define BOUNDEDQUEUE_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/* Blocking queue between two pipeline stages. Push waits while the queue is full,
+which bounds how many decoded images are alive at once. After Close, Push fails
+and Pop drains what is left before failing. */
+template<typename T>
+class BoundedQueue {
+
+private:
+    std::deque<T> items;
+    std::mutex lock;
+    std::condition_variable notFull, notEmpty;
+    size_t capacity;
+    bool closed = false;
+
+public:
+    BoundedQueue(size_t capacity): capacity(capacity) {}
+
+    bool Push(T item) {
+        std::unique_lock<std::mutex> guard(lock);
+        notFull.wait(guard, [this]() {return items.size() < capacity || closed;});
+        if (closed) {return false;}
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool Pop(T &item) {
+        std::unique_lock<std::mutex> guard(lock);
+        notEmpty.wait(guard, [this]() {return !items.empty() || closed;});
+        if (items.empty()) {return false;}
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+    // Cancellation: drop what is queued so the consumers stop too
+    void Abort() {
+        std::lock_guard<std::mutex> guard(lock);
+        items.clear();
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+};
+
+#endif
@@ -0,0 +1,200 @@
+#include "BufferPool.hpp"
+#include <algorithm>
+#include <new>
+
+#define POOL_MAX_CACHED_BYTES (size_t(1) << 30)
+// Capacity of the free lists, buffers or headers beyond it are freed
+#define POOL_MAX_FREE_BUFFERS 256
+#define POOL_MAX_FREE_HEADERS 1024
+
+// Init:
+BufferPool::BufferPool(size_t maxCachedBytes): maxCachedBytes(maxCachedBytes) {
+    freeBuffers.reserve(POOL_MAX_FREE_BUFFERS);
+    freeHeaders.reserve(POOL_MAX_FREE_HEADERS);
+}
+
+BufferPool::~BufferPool() {
+    for (auto &buffer : freeBuffers) {
+        cv::fastFree(buffer.second);
+    }
+    for (void *header : freeHeaders) {
+        ::operator delete(header);
+    }
+}
+
+BufferPool &BufferPool::Instance() {
+    // Never destroyed: Mats released during static destruction still return here
+    static BufferPool *pool = new BufferPool(POOL_MAX_CACHED_BYTES);
+    return *pool;
+}
+
+// cv::MatAllocator interface:
+cv::UMatData *BufferPool::allocate(int dims, const int *sizes, int type, void *data0, size_t *step,
+                                   cv::AccessFlag, cv::UMatUsageFlags) const {
+    size_t total = CV_ELEM_SIZE(type);
+    uchar *data = static_cast<uchar*>(data0);
+    void *header = nullptr;
+    int i;
+
+    // Same layout rules as OpenCV's default allocator
+    for (i=dims-1;i>=0;i--) {
+        if (step) {
+            if (data0 && step[i] != CV_AUTOSTEP) {
+                total = step[i];
+            } else {
+                step[i] = total;
+            }
+        }
+        total *= sizes[i];
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!data) {
+            // Few sizes are live at once, a linear scan beats a tree and allocates nothing
+            auto found = std::find_if(freeBuffers.begin(), freeBuffers.end(),
+                                      [total](const std::pair<size_t, uchar*> &buffer) {return buffer.first == total;});
+            if (found != freeBuffers.end()) {
+                data = found->second;
+                cachedBytes -= total;
+                *found = freeBuffers.back();
+                freeBuffers.pop_back();
+            } else {
+                freshAllocations++;
+            }
+            allocatedBytes += total;
+        }
+        if (!freeHeaders.empty()) {
+            header = freeHeaders.back();
+            freeHeaders.pop_back();
+        }
+    }
+
+    if (!data) {
+        data = static_cast<uchar*>(cv::fastMalloc(total));
+    }
+    if (!header) {
+        header = ::operator new(sizeof(cv::UMatData));
+    }
+
+    cv::UMatData *u = new (header) cv::UMatData(this);
+    u->data = u->origdata = data;
+    u->size = total;
+    if (data0) {
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+    }
+
+    return u;
+}
+
+bool BufferPool::allocate(cv::UMatData *data, cv::AccessFlag, cv::UMatUsageFlags) const {
+    return data != nullptr;
+}
+
+void BufferPool::deallocate(cv::UMatData *u) const {
+    if (!u) {return;}
+
+    CV_Assert(u->urefcount == 0);
+    CV_Assert(u->refcount == 0);
+
+    uchar *data = u->origdata;
+    size_t size = u->size;
+    bool owned = !(u->flags & cv::UMatData::USER_ALLOCATED);
+    u->~UMatData();
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (freeHeaders.size() < POOL_MAX_FREE_HEADERS) {
+        freeHeaders.push_back(u);
+    } else {
+        ::operator delete(u);
+    }
+    if (owned) {
+        if (cachedBytes + size <= maxCachedBytes && freeBuffers.size() < POOL_MAX_FREE_BUFFERS) {
+            freeBuffers.emplace_back(size, data);
+            cachedBytes += size;
+        } else {
+            cv::fastFree(data);
+        }
+    }
+}
+
+// Stats:
+size_t BufferPool::GetFreshAllocations() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return freshAllocations;
+}
+
+size_t BufferPool::GetCachedBytes() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return cachedBytes;
+}
+
+size_t BufferPool::GetAllocatedBytes() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return allocatedBytes;
+}
+
+// Uninitialized images drawn from the shared pool:
+cv::Mat PooledMat(cv::Size size, int type) {
+    cv::Mat newImg;
+    newImg.allocator = &BufferPool::Instance();
+    newImg.create(size, type);
+    return newImg;
+}
+
+cv::Mat PooledMat(int rows, int cols, int type) {
+    return PooledMat(cv::Size(cols, rows), type);
+}
+
+cv::Mat PooledClone(const cv::Mat &img) {
+    cv::Mat newImg;
+    newImg.allocator = &BufferPool::Instance();
+    newImg.create(img.dims, img.size.p, img.type());
+    img.copyTo(newImg);
+    return newImg;
+}
+
+// Shared by the 2-D and planar (3-D) outputs
+static cv::Mat CreateShaped(cv::OutputArray dst, int dims, const int *sizes, int type, const cv::Mat &src, bool inPlace) {
+    if (dst.kind() != cv::_InputArray::MAT) {
+        dst.create(dims, sizes, type);
+        return dst.getMat();
+    }
+
+    cv::Mat &dstMat = dst.getMatRef();
+    bool aliased = dstMat.data && dstMat.datastart == src.datastart;
+    bool sameShape = dstMat.dims == dims && dstMat.type() == type &&
+                     std::equal(sizes, sizes+dims, dstMat.size.p);
+
+    if (aliased && !(inPlace && sameShape)) {
+        dstMat.release();
+    }
+    if (dstMat.empty() || !sameShape) {
+        dstMat.allocator = &BufferPool::Instance();
+    }
+    dstMat.create(dims, sizes, type);
+
+    return dstMat;
+}
+
+cv::Mat CreateOutput(cv::OutputArray dst, cv::Size size, int type, const cv::Mat &src, bool inPlace) {
+    const int sizes[2] = {size.height, size.width};
+    return CreateShaped(dst, 2, sizes, type, src, inPlace);
+}
+
+cv::Mat CreatePlanarOutput(cv::OutputArray dst, int planes, cv::Size size, int type, const cv::Mat &src, bool inPlace) {
+    const int sizes[3] = {planes, size.height, size.width};
+    return CreateShaped(dst, 3, sizes, type, src, inPlace);
+}
+
+cv::Mat CreateOutputLike(cv::OutputArray dst, const cv::Mat &src, int type, bool inPlace) {
+    return CreateShaped(dst, src.dims, src.size.p, type, src, inPlace);
+}
+
+bool OwnsBuffer(const cv::Mat &img) {
+    return img.u && img.u->refcount == 1;
+}
+
+cv::Mat InPlaceTarget(const cv::Mat &img) {
+    return OwnsBuffer(img) ? img : cv::Mat();
+}
@@ -0,0 +1,61 @@
+#ifndef BUFFERPOOL_HPP
+#define BUFFERPOOL_HPP
+
+#include <opencv2/opencv.hpp>
+#include <mutex>
+#include <vector>
+
+/* Mat allocator that keeps released pixel buffers (and their UMatData headers)
+to hand them back to the next Mat of the same byte size. Buffers come back
+uninitialized, so kernels must write every pixel of their output. The free lists
+are flat vectors reserved up front, so recycling never touches the heap. */
+class BufferPool : public cv::MatAllocator {
+
+private:
+    mutable std::mutex lock;
+    mutable std::vector<std::pair<size_t, uchar*>> freeBuffers;
+    mutable std::vector<void*> freeHeaders;
+    mutable size_t cachedBytes = 0;
+    mutable size_t freshAllocations = 0;
+    mutable size_t allocatedBytes = 0;
+    size_t maxCachedBytes;
+
+public:
+    // Init:
+    BufferPool(size_t maxCachedBytes);
+    ~BufferPool();
+    static BufferPool &Instance();
+
+    // cv::MatAllocator interface:
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData *data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData *data) const override;
+
+    // Stats:
+    size_t GetFreshAllocations() const;
+    size_t GetCachedBytes() const;
+    // Bytes of every buffer handed out since creation, recycled ones included
+    size_t GetAllocatedBytes() const;
+};
+
+// Uninitialized images drawn from the shared pool:
+cv::Mat PooledMat(cv::Size size, int type);
+cv::Mat PooledMat(int rows, int cols, int type);
+cv::Mat PooledClone(const cv::Mat &img);
+
+/* Gets dst ready to receive a kernel output, drawing it from the pool when it has
+no buffer yet. If dst shares its pixels with src and the kernel cannot run in place,
+dst is detached first, so the caller must keep its own header of src alive. */
+cv::Mat CreateOutput(cv::OutputArray dst, cv::Size size, int type, const cv::Mat &src, bool inPlace);
+// Same for planar images (planes x rows x columns, one channel)
+cv::Mat CreatePlanarOutput(cv::OutputArray dst, int planes, cv::Size size, int type, const cv::Mat &src, bool inPlace);
+// Same shape as src, 2-D or planar, with another type
+cv::Mat CreateOutputLike(cv::OutputArray dst, const cv::Mat &src, int type, bool inPlace);
+
+// A buffer nobody else references can be overwritten by point operations
+bool OwnsBuffer(const cv::Mat &img);
+// Destination for a point operation on img: img itself when it can be overwritten
+cv::Mat InPlaceTarget(const cv::Mat &img);
+
+#endif
@@ -1,161 +1,176 @@
 #include "Histogram.hpp"
-#include <QWidget>
-#include <QVBoxLayout>
-#include <QString>
-#include <QtCharts/QChartView>
-#include <QtCharts/QLineSeries>
-#include <QtCharts/QBarSet>
-#include <QtCharts/QBarSeries>
-#include <QtCharts/QBarCategoryAxis>
-#include <QtCharts/QValueAxis>
 #include <iostream>
 #include <opencv2/highgui.hpp>
 #include <vector>
+#include "Simd.hpp"
 
-#define WINDOW_HEIGHT 480
-#define WINDOW_WIDTH 600
-QT_CHARTS_USE_NAMESPACE
-
-
-std::vector<int> Frequencies(cv::Mat img, int channel) {
-    std::vector<int> frequencies(256, 0);
+void Frequencies(const cv::Mat &img, int channel, std::vector<int> &frequencies) {
     int i, j;
-    const int rows=img.rows, columns=img.cols;
+    const int rows=img.rows, columns=img.cols, channels=img.channels();
 
+    frequencies.assign(256, 0);
     for (i=0;i<rows;i++) {
+        const uchar *row = img.ptr(i) + channel;
         for (j=0;j<columns;j++) {
-            frequencies[img.at<cv::Vec3b>(i,j)[channel]]++;
+            frequencies[row[j*channels]]++;
         }
     }
-
-    return frequencies;
 }
 
-std::vector<int> NormalizedFreq(std::vector<int> frequencies, int maxValue) {
-    std::vector<int> normalFrequencies(frequencies.size(), 0);
-    int i, j;
+void NormalizedFreq(const std::vector<int> &frequencies, int maxValue, std::vector<int> &normalFrequencies) {
+    int i;
     double normalBuffer;
 
+    normalFrequencies.resize(frequencies.size());
     for (i=0;i<frequencies.size();i++) {
         normalBuffer = (static_cast<double>(frequencies[i])/maxValue) * 255;
         normalFrequencies[i] = static_cast<int>(normalBuffer);
     }
-
-    return normalFrequencies;
 }
 
-std::vector<int> AcummulateFreq(std::vector<int> frequencies) {
-    std::vector<int> acumFrequencies = frequencies;
-    int i, j;
+void AcummulateFreq(const std::vector<int> &frequencies, std::vector<int> &acumFrequencies) {
+    int i;
 
-    for (i=1;i<frequencies.size();i++) {
+    if (&acumFrequencies != &frequencies) {
+        acumFrequencies = frequencies;
+    }
+    for (i=1;i<acumFrequencies.size();i++) {
         acumFrequencies[i] += acumFrequencies[i-1];
     }
+}
 
-    return acumFrequencies;
+void ChannelFrequencies(const cv::Mat &img, std::vector<std::vector<int>> &frequencies, bool luma) {
+    const int rows=img.rows, columns=img.cols, channels=img.channels();
+    // Luma is counted from the same reads, so colour images are never converted for it
+    const bool withLuma = luma && channels >= 3;
+    const int outputs = channels + (withLuma ? 1 : 0);
+    const int stripes = RowStripes(rows);
+    std::vector<int> stripeFrequencies(stripes*outputs*256, 0);
+    int s, k, value;
+
+    // Every stripe counts all channels in one pass over its rows
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range) {
+        for (int stripe=range.start;stripe<range.end;stripe++) {
+            cv::Range stripeRows = StripeRows(stripe, stripes, rows);
+            int *counts = &stripeFrequencies[stripe*outputs*256];
+            int *lumaCounts = counts + channels*256;
+            for (int i=stripeRows.start;i<stripeRows.end;i++) {
+                const uchar *row = img.ptr(i);
+                if (channels == 3 && !withLuma) {
+                    for (int j=0;j<columns;j++) {
+                        counts[row[j*3]]++;
+                        counts[256 + row[j*3 + 1]]++;
+                        counts[512 + row[j*3 + 2]]++;
+                    }
+                } else {
+                    for (int j=0;j<columns;j++) {
+                        const uchar *pixel = row + j*channels;
+                        for (int c=0;c<channels;c++) {
+                            counts[c*256 + pixel[c]]++;
+                        }
+                        if (withLuma) {
+                            // Same weights as GreyScale and ProxyFrequencies
+                            lumaCounts[uchar(0.114*pixel[0] + 0.587*pixel[1] + 0.299*pixel[2])]++;
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    frequencies.assign(outputs, std::vector<int>(256, 0));
+    for (s=0;s<stripes;s++) {
+        for (k=0;k<outputs;k++) {
+            for (value=0;value<256;value++) {
+                frequencies[k][value] += stripeFrequencies[(s*outputs + k)*256 + value];
+            }
+        }
+    }
 }
 
-void DrawBarHistogram(const std::vector<int> frequencies, const QString windowName) {
-    
-    QBarSet *set = new QBarSet("");
-    for (int value : frequencies) {*set << value;}
-    set->setColor(Qt::black);
-
-    QBarSeries *series = new QBarSeries();
-    series->append(set);
-    series->setBarWidth(0.9);
-    
-    QChart *chart = new QChart();
-    chart->addSeries(series);
-    chart->setAnimationOptions(QChart::SeriesAnimations);
-    chart->legend()->hide();
-
-    QStringList categories;
-    for (int i=0;i<frequencies.size();++i) {
-        categories << QString::number(frequencies[i]);
+void TileFrequencies(const cv::Mat &img, int channel, cv::Size tiles, std::vector<std::vector<int>> &frequencies) {
+    const int rows=img.rows, columns=img.cols, channels=img.channels();
+
+    frequencies.assign(tiles.area(), std::vector<int>(256, 0));
+
+    // Tiles never share a histogram, so each one is counted by a single thread
+    cv::parallel_for_(cv::Range(0, tiles.area()), [&](const cv::Range &range) {
+        for (int tile=range.start;tile<range.end;tile++) {
+            cv::Range tileRows = StripeRows(tile / tiles.width, tiles.height, rows);
+            cv::Range tileColumns = StripeRows(tile % tiles.width, tiles.width, columns);
+            int *counts = frequencies[tile].data();
+            for (int i=tileRows.start;i<tileRows.end;i++) {
+                const uchar *row = img.ptr(i);
+                for (int j=tileColumns.start;j<tileColumns.end;j++) {
+                    counts[row[j*channels + channel]]++;
+                }
+            }
+        }
+    });
+}
+
+// Same values as NormalizedFreq(AcummulateFreq(frequencies)), straight into a byte table
+void EqualizationLUT(const std::vector<int> &frequencies, int totalOfPixels, uchar lut[256]) {
+    long long accumulated = 0;
+    int value;
+
+    for (value=0;value<256;value++) {
+        accumulated += frequencies[value];
+        lut[value] = static_cast<uchar>((static_cast<double>(accumulated)/totalOfPixels) * 255);
+    }
+}
+
+/* Contrast-limited map: counts above clipLimit times the mean bin height are cut
+and handed back evenly to every bin before accumulating. */
+void ClippedEqualizationLUT(const std::vector<int> &frequencies, int totalOfPixels, double clipLimit, uchar lut[256]) {
+    std::vector<int> clipped(256);
+    int limit = std::max(1, static_cast<int>(clipLimit * totalOfPixels / 256));
+    int excess = 0, bonus, remainder;
+    int value;
+
+    for (value=0;value<256;value++) {
+        if (frequencies[value] > limit) {
+            excess += frequencies[value] - limit;
+            clipped[value] = limit;
+        } else {
+            clipped[value] = frequencies[value];
+        }
     }
 
-    QValueAxis *axisX = new QValueAxis();
-    axisX->setRange(0, frequencies.size()-1);
-    axisX->setTickCount(10); 
-    axisX->setLabelFormat("%i");
-    chart->addAxis(axisX, Qt::AlignBottom);
-    series->attachAxis(axisX);
-
-    QValueAxis *axisY = new QValueAxis();
-    axisY->setRange(0, *std::max_element(frequencies.begin(), frequencies.end()));
-    axisY->setTickCount(10); 
-    axisY->setLabelFormat("%i");
-    chart->addAxis(axisY, Qt::AlignLeft);
-    series->attachAxis(axisY);
-
-    QChartView *chartView = new QChartView(chart);
-    chartView->setRenderHint(QPainter::Antialiasing);
-
-    QWidget *window = new QWidget;
-    QVBoxLayout *layout = new QVBoxLayout(window);
-    layout->addWidget(chartView);
-    window->setWindowTitle(windowName);
-    window->resize(WINDOW_WIDTH, WINDOW_HEIGHT);
-    window->show();
+    bonus = excess / 256;
+    remainder = excess % 256;
+    for (value=0;value<256;value++) {
+        clipped[value] += bonus + (value < remainder ? 1 : 0);
+    }
+
+    EqualizationLUT(clipped, totalOfPixels, lut);
 }
 
-void DrawLineHistogram(cv::Mat img, const QString windowName) {
-    int rows=img.rows, columns=img.cols;
-    int totalOfPixels = rows*columns;
-
-    std::vector<int> blue = Frequencies(img, 0);
-    std::vector<int> green = Frequencies(img, 1);
-    std::vector<int> red = Frequencies(img, 2);
-    
-    QLineSeries *blueLineSeries = new QLineSeries();
-    QLineSeries *greenLineSeries = new QLineSeries();
-    QLineSeries *redLineSeries = new QLineSeries();
-    blueLineSeries->setColor(QColor(0, 0, 255));
-    greenLineSeries->setColor(QColor(0, 255, 0));
-    redLineSeries->setColor(QColor(255, 0, 0));
-    for (size_t i = 0; i < blue.size(); ++i) {
-        blueLineSeries->append(i, blue[i]);
-        greenLineSeries->append(i, green[i]);
-        redLineSeries->append(i, red[i]);
+void ProxyFrequencies(const cv::Mat &img, int step, std::vector<std::vector<int>> &frequencies) {
+    const int rows=img.rows, columns=img.cols, channels=img.channels();
+    // Alpha is not charted, colour images get luma in its place
+    const int colours = std::min(channels, 3);
+    const int outputs = colours == 3 ? 4 : colours;
+    int i, j, k, value;
+
+    frequencies.assign(outputs, std::vector<int>(256, 0));
+    for (i=0;i<rows;i+=step) {
+        const uchar *row = img.ptr(i);
+        for (j=0;j<columns;j+=step) {
+            const uchar *pixel = row + j*channels;
+            for (k=0;k<colours;k++) {
+                frequencies[k][pixel[k]]++;
+            }
+            if (colours == 3) {
+                // Same weights as GreyScale, so a later conversion lands on this curve
+                frequencies[3][uchar(0.114*pixel[0] + 0.587*pixel[1] + 0.299*pixel[2])]++;
+            }
+        }
     }
 
-    QChart *chart = new QChart();
-    chart->addSeries(blueLineSeries);
-    chart->addSeries(greenLineSeries);
-    chart->addSeries(redLineSeries);
-    chart->setAnimationOptions(QChart::SeriesAnimations);
-    chart->legend()->hide();
-
-    QValueAxis *axisX = new QValueAxis();
-    axisX->setRange(0, blue.size()-1);
-    axisX->setTickCount(10); 
-    axisX->setLabelFormat("%i");
-    chart->addAxis(axisX, Qt::AlignBottom);
-    blueLineSeries->attachAxis(axisX);
-    greenLineSeries->attachAxis(axisX);
-    redLineSeries->attachAxis(axisX);
-
-    int maxFrequency = std::max(*std::max_element(blue.begin(), blue.end()),
-                                std::max(*std::max_element(green.begin(), green.end()),
-                                        *std::max_element(red.begin(), red.end())));
-
-    QValueAxis *axisY = new QValueAxis();
-    axisY->setRange(0, maxFrequency);
-    axisY->setTickCount(10); 
-    axisY->setLabelFormat("%i");
-    chart->addAxis(axisY, Qt::AlignLeft);
-    blueLineSeries->attachAxis(axisY);
-    greenLineSeries->attachAxis(axisY);
-    redLineSeries->attachAxis(axisY);
-
-    QChartView *chartView = new QChartView(chart);
-    chartView->setRenderHint(QPainter::Antialiasing);
-
-    QWidget *window = new QWidget;
-    QVBoxLayout *layout = new QVBoxLayout(window);
-    layout->addWidget(chartView);
-    window->setWindowTitle(windowName);
-    window->resize(WINDOW_WIDTH, WINDOW_HEIGHT);
-    window->show(); 
-}
\ No newline at end of file
+    for (k=0;k<outputs;k++) {
+        for (value=0;value<256;value++) {
+            frequencies[k][value] *= step*step;
+        }
+    }
+}
@@ -3,12 +3,21 @@
 
 #include <opencv2/opencv.hpp>
 #include <vector>
-#include <QString>
 
-std::vector<int> Frequencies(cv::Mat img, int channel);
-std::vector<int> NormalizedFreq(std::vector<int> frequencies, int maxValue);
-std::vector<int> AcummulateFreq(std::vector<int> frequencies);
-void DrawBarHistogram(const std::vector<int> frequencies, const QString windowName);
-void DrawLineHistogram(cv::Mat img, const QString windowName);
+// Outputs are resized as needed and may be the same vector as the input
+void Frequencies(const cv::Mat &img, int channel, std::vector<int> &frequencies);
+void NormalizedFreq(const std::vector<int> &frequencies, int maxValue, std::vector<int> &normalFrequencies);
+void AcummulateFreq(const std::vector<int> &frequencies, std::vector<int> &acumFrequencies);
 
-#endif
\ No newline at end of file
+/* Equalization engine: histograms are counted per stripe (or tile) in parallel. With luma,
+colour images get a luma histogram appended, counted in the same pass. */
+void ChannelFrequencies(const cv::Mat &img, std::vector<std::vector<int>> &frequencies, bool luma = false);
+void TileFrequencies(const cv::Mat &img, int channel, cv::Size tiles, std::vector<std::vector<int>> &frequencies);
+void EqualizationLUT(const std::vector<int> &frequencies, int totalOfPixels, uchar lut[256]);
+void ClippedEqualizationLUT(const std::vector<int> &frequencies, int totalOfPixels, double clipLimit, uchar lut[256]);
+
+/* Counts every step-th row and column, scaled back to full-frame pixels. Colour images
+get luma appended, alpha is left out. */
+void ProxyFrequencies(const cv::Mat &img, int step, std::vector<std::vector<int>> &frequencies);
+
+#endif
@@ -0,0 +1,190 @@
+#include "HistogramPanel.hpp"
+#include <QVBoxLayout>
+#include <QPen>
+#include <QPointF>
+#include <QVector>
+#include <cmath>
+#include "Histogram.hpp"
+#include "ImageMatrix.hpp"
+
+#define WINDOW_HEIGHT 480
+#define WINDOW_WIDTH 600
+QT_CHARTS_USE_NAMESPACE
+
+// Init:
+HistogramPanel::HistogramPanel(QWidget *parent, int proxyPixels): QWidget(parent), proxyPixels(proxyPixels) {
+    const QColor colors[3] = {QColor(0, 0, 255), QColor(0, 255, 0), QColor(255, 0, 0)};
+    int k;
+
+    chart = new QChart();
+    chart->setAnimationOptions(QChart::NoAnimation);
+    chart->legend()->hide();
+
+    QValueAxis *axisX = new QValueAxis();
+    axisX->setRange(0, 255);
+    axisX->setTickCount(10);
+    axisX->setLabelFormat("%i");
+    chart->addAxis(axisX, Qt::AlignBottom);
+
+    axisY = new QValueAxis();
+    axisY->setTickCount(10);
+    axisY->setLabelFormat("%i");
+    chart->addAxis(axisY, Qt::AlignLeft);
+
+    // Previous frequencies are drawn dashed behind the current ones
+    for (k=0;k<3;k++) {
+        beforeSeries[k] = new QLineSeries();
+        afterSeries[k] = new QLineSeries();
+        beforeSeries[k]->setPen(QPen(colors[k], 1, Qt::DashLine));
+        afterSeries[k]->setPen(QPen(colors[k], 1));
+        chart->addSeries(beforeSeries[k]);
+        chart->addSeries(afterSeries[k]);
+        beforeSeries[k]->attachAxis(axisX);
+        beforeSeries[k]->attachAxis(axisY);
+        afterSeries[k]->attachAxis(axisX);
+        afterSeries[k]->attachAxis(axisY);
+    }
+
+    lumaSeries = new QLineSeries();
+    lumaSeries->setPen(QPen(QColor(Qt::black), 1));
+    chart->addSeries(lumaSeries);
+    lumaSeries->attachAxis(axisX);
+    lumaSeries->attachAxis(axisY);
+    lumaSeries->setVisible(false);
+
+    // Docked panels are too narrow for labelled axes
+    if (parent) {
+        axisX->setVisible(false);
+        axisY->setVisible(false);
+    }
+
+    QChartView *chartView = new QChartView(chart, this);
+    chartView->setRenderHint(QPainter::Antialiasing);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(chartView);
+    resize(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+    worker = std::thread(&HistogramPanel::Work, this);
+}
+
+HistogramPanel::~HistogramPanel() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+// Requests:
+void HistogramPanel::ShowHistogram(const cv::Mat &img, bool grey, const QString &title) {
+    ShowComparison(cv::Mat(), img, grey, title);
+}
+
+void HistogramPanel::ShowComparison(const cv::Mat &before, const cv::Mat &after, bool grey, const QString &title) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        request.before = before;
+        request.after = after;
+        request.grey = grey;
+        request.title = title;
+        pending = true;
+    }
+    wake.notify_one();
+}
+
+// Background counting, the chart itself is only touched on the GUI thread
+void HistogramPanel::Work() {
+    while (true) {
+        Request current;
+        Result result;
+
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this]() {return pending || stopping;});
+            if (stopping) {return;}
+            current = request;
+            request = Request();
+            pending = false;
+        }
+
+        // Wider working spaces are counted on 256 levels as well
+        if (!current.before.empty()) {
+            ChannelFrequencies(DisplayDepth(current.before), result.before);
+        }
+        // Colour images get their luma curve without being converted to grey
+        if (proxyPixels > 0) {
+            // Only the proxy is sampled and narrowed, whatever the size and depth of the frame
+            int step = std::max(1, int(std::sqrt(double(ImageSize(current.after).area()) / proxyPixels)));
+            ProxyFrequencies(DisplayDepth(Subsample(current.after, step)), 1, result.after);
+            if (result.after.size() == 4) {
+                result.luma = result.after[3];
+                result.after.pop_back();
+            }
+        } else if (!current.grey && ImageChannels(current.after) >= 3) {
+            ChannelFrequencies(DisplayDepth(current.after), result.after, true);
+            result.luma = result.after.back();
+            result.after.pop_back();
+        } else {
+            ChannelFrequencies(DisplayDepth(current.after), result.after);
+        }
+        result.grey = current.grey;
+        result.title = current.title;
+
+        QMetaObject::invokeMethod(this, [this, result]() {
+            Apply(result);
+        }, Qt::QueuedConnection);
+    }
+}
+
+void HistogramPanel::Apply(const Result &result) {
+    QVector<QPointF> points(256);
+    int maxFrequency = 1;
+    int channels = result.grey ? 1 : 3;
+    int k, value;
+
+    // Grey images have equal channels, so one black line is enough
+    afterSeries[0]->setColor(result.grey ? QColor(Qt::black) : QColor(0, 0, 255));
+    beforeSeries[0]->setPen(QPen(result.grey ? QColor(Qt::gray) : QColor(0, 0, 255), 1, Qt::DashLine));
+
+    for (k=0;k<3;k++) {
+        bool visible = k < channels && k < static_cast<int>(result.after.size());
+        afterSeries[k]->setVisible(visible);
+        if (visible) {
+            for (value=0;value<256;value++) {
+                points[value] = QPointF(value, result.after[k][value]);
+                maxFrequency = std::max(maxFrequency, result.after[k][value]);
+            }
+            afterSeries[k]->replace(points);
+        }
+
+        visible = k < channels && k < static_cast<int>(result.before.size());
+        beforeSeries[k]->setVisible(visible);
+        if (visible) {
+            for (value=0;value<256;value++) {
+                points[value] = QPointF(value, result.before[k][value]);
+                maxFrequency = std::max(maxFrequency, result.before[k][value]);
+            }
+            beforeSeries[k]->replace(points);
+        }
+    }
+
+    // Luma only adds information when the channels differ
+    bool showLuma = !result.grey && !result.luma.empty();
+    lumaSeries->setVisible(showLuma);
+    if (showLuma) {
+        for (value=0;value<256;value++) {
+            points[value] = QPointF(value, result.luma[value]);
+            maxFrequency = std::max(maxFrequency, result.luma[value]);
+        }
+        lumaSeries->replace(points);
+    }
+
+    axisY->setRange(0, maxFrequency);
+    if (!parentWidget()) {
+        setWindowTitle(result.title);
+        show();
+        raise();
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef HISTOGRAMPANEL_HPP
+#define HISTOGRAMPANEL_HPP
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <QString>
+#include <QWidget>
+#include <QtCharts/QChart>
+#include <QtCharts/QChartView>
+#include <QtCharts/QLineSeries>
+#include <QtCharts/QValueAxis>
+
+/* Single histogram window that lives as long as the application. Bins are counted
+on a background thread and the existing series are updated in place, so showing a
+histogram never builds a chart or leaks a window. Only the latest request is kept.
+With a parent the panel is docked into it instead, and with proxyPixels it counts
+a subsampled proxy of about that many pixels. Colour images also get a luma curve,
+counted from the same reads. */
+class HistogramPanel : public QWidget {
+
+private:
+    struct Request {
+        cv::Mat before;
+        cv::Mat after;
+        bool grey;
+        QString title;
+    };
+
+    struct Result {
+        std::vector<std::vector<int>> before;
+        std::vector<std::vector<int>> after;
+        std::vector<int> luma;
+        bool grey;
+        QString title;
+    };
+
+    QtCharts::QChart *chart;
+    QtCharts::QLineSeries *beforeSeries[3];
+    QtCharts::QLineSeries *afterSeries[3];
+    QtCharts::QLineSeries *lumaSeries;
+    QtCharts::QValueAxis *axisY;
+
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake;
+    Request request;
+    bool pending = false,
+         stopping = false;
+    int proxyPixels;
+
+    void Work();
+    void Apply(const Result &result);
+
+public:
+    // Init:
+    HistogramPanel(QWidget *parent = nullptr, int proxyPixels = 0);
+    ~HistogramPanel();
+
+    // Requests (images are only read, their pixels are kept alive by the shared headers):
+    void ShowHistogram(const cv::Mat &img, bool grey, const QString &title);
+    void ShowComparison(const cv::Mat &before, const cv::Mat &after, bool grey, const QString &title);
+};
+
+#endif
@@ -3,37 +3,128 @@
 #include <opencv2/highgui.hpp>
 #include <opencv2/opencv.hpp>
 #include <QPixmap>
+#include <QPainter>
 #include <QLabel>
 #include "ImageMatrix.hpp"
 #include "Histogram.hpp"
+#include "BufferPool.hpp"
 
 #define DESCRIPTION_HEIGHT 20
 #define SPACE 5
 #define TITLE_ABOVE     DESCRIPTION_HEIGHT+SPACE*2
+#define PROFILE_OPERATIONS 4
+#define ADAPTIVE_TILES 8
+#define ADAPTIVE_CLIP_LIMIT 2.0
+
+// BGRA is laid out as Qt's ARGB32 in memory, so only BGR needs its channels swapped
+static QPixmap ToPixmap(const cv::Mat &img) {
+    cv::Mat shown = DisplayDepth(img);
+
+    if (shown.channels() == 4) {
+        QImage qImg(shown.data, shown.cols, shown.rows, shown.step, QImage::Format_ARGB32);
+        return QPixmap::fromImage(qImg);
+    }
+    QImage qImg(shown.data, shown.cols, shown.rows, shown.step, QImage::Format_RGB888);
+    return QPixmap::fromImage(qImg.rgbSwapped());
+}
 
 // Init:
-ImageEditingManager::ImageEditingManager(cv::Mat newImg):
-    currentImg(newImg), parameterBuffer(newImg), resetBuffer(newImg), grey(IsGrey(newImg)) {}
+ImageEditingManager::ImageEditingManager(cv::Mat newImg, int workingDepth, bool planar):
+    grey(IsGrey(newImg)), resetGrey(grey) {
+    // Edits run at the working depth, rounding to 8-bit only happens when showing or saving
+    if (workingDepth < 0 || newImg.depth() == workingDepth) {
+        resetBuffer = newImg;
+    } else {
+        ConvertDepth(newImg, resetBuffer, workingDepth);
+    }
+    // Likewise, planes are only interleaved again to show or save
+    if (planar) {
+        ToPlanar(cv::Mat(resetBuffer), resetBuffer);
+    }
+    currentImg = resetBuffer;
+    parameterBuffer = resetBuffer;
+    recipe.SetWorkingDepth(workingDepth);
+}
 
 // Get, set, others:
 void ImageEditingManager::ShowImage() {
-    const uchar *qImageBuffer = (const uchar*)currentImg.data;
-    // Create QImage with same dimensions as input
-    QImage qImg(qImageBuffer, currentImg.cols, currentImg.rows, currentImg.step, QImage::Format_RGB888);
-    imgLabel->setPixmap(QPixmap::fromImage(qImg.rgbSwapped()));
+    profiler.BeginPhase("ShowImage");
+    cv::Size size = ImageSize(currentImg);
+    cv::Rect area = dirty & cv::Rect(cv::Point(), size);
+
+    // Only the dirty rectangle is converted, and replaces its pixels in the previous frame
+    if (!area.empty() && area.size() != size && shownPixmap.width() == size.width && shownPixmap.height() == size.height) {
+        // The label lets go of the frame first, or QPainter would detach (copy) all of it
+        imgLabel->setPixmap(QPixmap());
+        QPainter painter(&shownPixmap);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawPixmap(area.x, area.y, ToPixmap(Region(currentImg, area)));
+        painter.end();
+    } else {
+        shownPixmap = ToPixmap(currentImg);
+    }
+    imgLabel->setPixmap(shownPixmap);
+    dirty = cv::Rect();
+    profiler.EndPhase();
+}
+
+void ImageEditingManager::ShowOriginal(QLabel *label) {
+    label->setPixmap(ToPixmap(resetBuffer));
 }
 
 void ImageEditingManager::UpdateParameters() {
-    currentImg = parameterBuffer.clone();
+    profiler.BeginPhase("UpdateParameters");
+    // Parameters apply to the edge map when there is one
+    const cv::Mat input = edgeView.empty() ? parameterBuffer : edgeView;
+    cv::Mat source = input;
+    cv::Size size = ImageSize(input);
+    cv::Rect area = dirty & cv::Rect(cv::Point(), size);
+    edited = true;
+
+    /* Only the dirty rectangle is recomputed, into the previous output. Quantization
+    depends on the range of the whole image, so it always takes the full path. */
+    bool partial = !area.empty() && area.size() != size && !quantized && OwnsBuffer(currentImg) &&
+                   currentImg.type() == input.type() && currentImg.dims == input.dims &&
+                   ImageSize(currentImg) == size;
+    if (partial) {
+        cv::Mat target = Region(currentImg, area);
+        source = Region(input, area);
+        if (contrast) {
+            Contrast(source, target, lastContrast);
+            source = target;
+        }
+        if (bright) {
+            Brightness(source, target, lastBrightness);
+            source = target;
+        }
+        if (source.data != target.data) {
+            source.copyTo(target);
+        }
+        profiler.EndPhase();
+        return;
+    }
+
+    // The first stage writes into the previous output, the others run in place on it
+    if (!OwnsBuffer(currentImg)) {
+        currentImg.release();
+    }
     if (quantized) {
-        currentImg = Quantization(currentImg, lastQuantity);
+        Quantization(source, currentImg, lastQuantity);
+        source = currentImg;
     }
     if (contrast) {
-        currentImg = Contrast(currentImg, lastContrast);
+        Contrast(source, currentImg, lastContrast);
+        source = currentImg;
     }
     if (bright) {
-        currentImg = Brightness(currentImg, lastBrightness);
+        Brightness(source, currentImg, lastBrightness);
+        source = currentImg;
+    }
+    if (source.data == input.data) {
+        CreateOutputLike(currentImg, input, input.type(), false);
+        input.copyTo(currentImg);
     }
+    profiler.EndPhase();
 }
 
 void ImageEditingManager::SetTitleLabel(QLabel *newLabel) {
@@ -53,74 +144,268 @@ void ImageEditingManager::SetMinHeight(int newHeight) {
     minHeight = newHeight;
 }
 
+// A greyscale selection leaves the rest of the image coloured
+void ImageEditingManager::GreyParameterBuffer() {
+    ApplyInSelection([](const cv::Mat &src, cv::Mat &dst) {GreyScale(src, dst);}, 0);
+    recipe.Add(Recipe::Greyscale);
+    if (!HasSelection()) {
+        grey = true;
+    }
+}
+
+// Same-size kernels run on the selection only, margin is the reach of their neighbourhood
+void ImageEditingManager::ApplyInSelection(const std::function<void(const cv::Mat&, cv::Mat&)> &kernel, int margin) {
+    // Tone changes made after this one start from its result
+    DropSelectionTone();
+    CommitEdgeView();
+    if (!HasSelection()) {
+        cv::Mat newBuffer = InPlaceTarget(parameterBuffer);
+        kernel(parameterBuffer, newBuffer);
+        parameterBuffer = newBuffer;
+        dirty = FullFrame();
+        return;
+    }
+
+    ApplyInRegion(parameterBuffer, selection, selectionMask, margin, kernel);
+    dirty |= selection;
+}
+
+/* Edge maps of the whole colour image go to edgeView, so parameterBuffer keeps its colours
+until the map is committed. A grey image or a selection has no colours to keep. */
+void ImageEditingManager::ApplyEdgeMap(const std::function<void(const cv::Mat&, cv::Mat&)> &kernel, int margin) {
+    if (HasSelection() || (grey && edgeView.empty())) {
+        ApplyInSelection(kernel, margin);
+        if (!HasSelection()) {
+            grey = true;
+        }
+        return;
+    }
+
+    // Maps of maps run on the previous map, in place when nothing else holds it
+    cv::Mat newView = InPlaceTarget(edgeView);
+    kernel(edgeView.empty() ? parameterBuffer : edgeView, newView);
+    edgeView = newView;
+    grey = true;
+    dirty = FullFrame();
+}
+
+// The map becomes the image and the colours under it are let go
+void ImageEditingManager::CommitEdgeView() {
+    if (edgeView.empty()) {return;}
+    parameterBuffer = edgeView;
+    edgeView.release();
+}
+
+/* Brightness and contrast of a selection are baked in, but every change starts again from
+the pixels it had before the first one, so slider values replace each other instead of
+stacking. The recipe keeps a single step for them. */
+void ImageEditingManager::ApplySelectionTone() {
+    const int bias = selectionBias;
+    const float gain = selectionGain;
+
+    CommitEdgeView();
+    if (selectionBase.empty()) {
+        selectionBase = PooledClone(Region(parameterBuffer, selection));
+    }
+    const cv::Mat base = selectionBase;
+    ApplyInRegion(parameterBuffer, selection, selectionMask, 0, [base, bias, gain](const cv::Mat &, cv::Mat &dst) {
+        Contrast(base, dst, gain);
+        Brightness(dst, dst, bias);
+    });
+    dirty |= selection;
+    recipe.SetRegionTone(bias, gain);
+}
+
+void ImageEditingManager::DropSelectionTone() {
+    selectionBase.release();
+    selectionBias = 0;
+    selectionGain = 1;
+}
+
+cv::Rect ImageEditingManager::FullFrame() {
+    return cv::Rect(cv::Point(), ImageSize(parameterBuffer));
+}
+
 bool ImageEditingManager::GetGreyFlag() {
     return grey;
 }
 
+bool ImageEditingManager::IsEdited() {
+    return edited;
+}
+
+cv::Size ImageEditingManager::GetOriginalSize() {
+    return ImageSize(resetBuffer);
+}
+
+const Recipe &ImageEditingManager::GetRecipe() {
+    return recipe;
+}
+
 void ImageEditingManager::Resize() {
-    int newWidth = window->width()-imgLabel->width()+parameterBuffer.cols;
+    cv::Size size = ImageSize(parameterBuffer);
+    int newWidth = window->width()-imgLabel->width()+size.width;
     int newHeight = minHeight;
-    if (newHeight < parameterBuffer.rows+TITLE_ABOVE+SPACE) {
-        newHeight = parameterBuffer.rows+TITLE_ABOVE+SPACE;
+    if (newHeight < size.height+TITLE_ABOVE+SPACE) {
+        newHeight = size.height+TITLE_ABOVE+SPACE;
     }
 
     window->setFixedSize(newWidth, newHeight);
-    titleLabel->setFixedSize(parameterBuffer.cols, titleLabel->height());
-    imgLabel->setFixedSize(parameterBuffer.cols, parameterBuffer.rows);
+    titleLabel->setFixedSize(size.width, titleLabel->height());
+    imgLabel->setFixedSize(size.width, size.height);
+
+}
 
+// Selection:
+void ImageEditingManager::SetSelectionTool(SelectionTool *newTool) {
+    selectionTool = newTool;
+    // The outline on screen belonged to the previous document
+    ClearSelection();
+}
+
+void ImageEditingManager::SetSelection(cv::Rect newSelection, const cv::Mat &newMask) {
+    DropSelectionTone();
+    selection = newSelection & FullFrame();
+    selectionMask.release();
+    if (selection.empty()) {
+        ClearSelection();
+        return;
+    }
+    if (!newMask.empty()) {
+        selectionMask = newMask(cv::Rect(selection.tl() - newSelection.tl(), selection.size()));
+    }
+    recipe.SetRegion(selection, selectionMask);
+}
+
+void ImageEditingManager::ClearSelection() {
+    DropSelectionTone();
+    selection = cv::Rect();
+    selectionMask.release();
+    recipe.SetRegion(cv::Rect(), cv::Mat());
+    if (selectionTool) {
+        selectionTool->Clear();
+    }
+}
+
+bool ImageEditingManager::HasSelection() {
+    return !selection.empty();
 }
 
 void ImageEditingManager::Save() {
-    cv::imwrite("DuckyShop.jpeg", currentImg);
+    // JPEG has no alpha, so cut-outs are saved as PNG
+    if (ImageChannels(currentImg) == 4) {
+        cv::imwrite("DuckyShop.png", EncoderDepth(currentImg));
+    } else {
+        cv::imwrite("DuckyShop.jpeg", DisplayDepth(currentImg));
+    }
+}
+
+void ImageEditingManager::FinishOperation() {
+    // Only shares the header: the live panel counts its proxy on its own thread
+    if (liveHistogram) {
+        liveHistogram->ShowHistogram(currentImg, grey, "Live histogram");
+    }
+    profiler.EndOperation();
+    if (profileLabel && profileLabel->isVisible()) {
+        profileLabel->setText(QString::fromStdString(profiler.Summary(PROFILE_OPERATIONS)));
+    }
 }
 
 // Image operations:
 void ImageEditingManager::MirrorHorizontally() {
-    parameterBuffer = InvertHorizontally(parameterBuffer);
+    profiler.BeginOperation("Mirror horizontally");
+    profiler.BeginPhase("kernel");
+    // Geometry moves the selected pixels, so the selection is dropped
+    ClearSelection();
+    CommitEdgeView();
+    InvertHorizontally(parameterBuffer, parameterBuffer);
+    dirty = FullFrame();
+    recipe.Add(Recipe::MirrorHorizontally);
+    profiler.EndPhase();
     UpdateParameters();
     ShowImage();
+    FinishOperation();
 }
 
 void ImageEditingManager::MirrorVertically() {
-    parameterBuffer = InvertVertically(parameterBuffer);
+    profiler.BeginOperation("Mirror vertically");
+    profiler.BeginPhase("kernel");
+    ClearSelection();
+    CommitEdgeView();
+    InvertVertically(parameterBuffer, parameterBuffer);
+    dirty = FullFrame();
+    recipe.Add(Recipe::MirrorVertically);
+    profiler.EndPhase();
     UpdateParameters();
     ShowImage();
+    FinishOperation();
 }
 
 void ImageEditingManager::ConvertGreyscale() {
+    profiler.BeginOperation("Greyscale");
+    // An edge map is grey already, asking for greyscale commits it
+    CommitEdgeView();
     if (!grey) {
-        parameterBuffer = GreyScale(parameterBuffer);
-        grey = true;
+        profiler.BeginPhase("kernel");
+        GreyParameterBuffer();
+        profiler.EndPhase();
         UpdateParameters();
         ShowImage();
     }
+    FinishOperation();
 }
 
 void ImageEditingManager::ConvertNegative() {
-    parameterBuffer = Negative(parameterBuffer);
+    profiler.BeginOperation("Negative");
+    profiler.BeginPhase("kernel");
+    ApplyInSelection([](const cv::Mat &src, cv::Mat &dst) {Negative(src, dst);}, 0);
+    recipe.Add(Recipe::Negative);
+    profiler.EndPhase();
     UpdateParameters();
     ShowImage();
+    FinishOperation();
 }
 
 void ImageEditingManager::ZoomIn() {
-    parameterBuffer = Enlarge(parameterBuffer);
+    profiler.BeginOperation("Zoom in");
+    profiler.BeginPhase("kernel");
+    ClearSelection();
+    CommitEdgeView();
+    Enlarge(parameterBuffer, parameterBuffer);
+    recipe.Add(Recipe::ZoomIn);
+    profiler.EndPhase();
     Resize();
     UpdateParameters();
     ShowImage();
+    FinishOperation();
 }
 
 void ImageEditingManager::ZoomOut(int sx, int sy) {
-    parameterBuffer = Reduce(parameterBuffer, sx, sy);
+    profiler.BeginOperation("Zoom out");
+    profiler.BeginPhase("kernel");
+    ClearSelection();
+    CommitEdgeView();
+    Reduce(parameterBuffer, parameterBuffer, sx, sy);
+    recipe.Add(Recipe::ZoomOut, sx, sy);
+    profiler.EndPhase();
     Resize();
     UpdateParameters();
     ShowImage();
+    FinishOperation();
 }
 
 void ImageEditingManager::Rotate() {
-    parameterBuffer = Rotate90(parameterBuffer);
+    profiler.BeginOperation("Rotate");
+    profiler.BeginPhase("kernel");
+    ClearSelection();
+    CommitEdgeView();
+    Rotate90(parameterBuffer, parameterBuffer);
+    recipe.Add(Recipe::Rotate);
+    profiler.EndPhase();
     Resize();
     UpdateParameters();
     ShowImage();
+    FinishOperation();
 }
 
 // Image filters:
@@ -144,9 +429,15 @@ bool IsLowPass(double kernel[3][3]) {
     else return false;
 }
 
-void ImageEditingManager::ApplyFilter(double kernel[3][3], bool clampping) {
+void ImageEditingManager::ApplyFilter(double kernel[3][3], bool clampping, int border) {
     int i, j;
     double invertedKernel[3][3];
+    /* Filters that are not low-pass give an edge map of the luma, computed as they go instead
+    of greyscaling first, and the colour image stays under it */
+    bool edges = !IsLowPass(kernel);
+    bool luma = edges && !grey;
+
+    profiler.BeginOperation("Filter");
 
     for (i=0;i<3;i++) {
         for (j=0;j<3;j++) {
@@ -154,96 +445,273 @@ void ImageEditingManager::ApplyFilter(double kernel[3][3], bool clampping) {
         }
     }
 
-    // Apply greyscale if not low-pass
-    if (!IsLowPass(kernel) && !grey) {
-        parameterBuffer = GreyScale(parameterBuffer);
-        grey = true;
-    }
+    profiler.BeginPhase("kernel");
 
     /* In this case, I'm not so sure that updating parameters as quantization after 
     convolution would not make a difference if compared to updating parameters before.*/
 
-    parameterBuffer = Convolution(parameterBuffer, invertedKernel, clampping);
+    // The 3x3 kernel reads one pixel around the selection
+    auto filter = [&invertedKernel, clampping, border, luma](const cv::Mat &src, cv::Mat &dst) {
+        Convolution(src, dst, invertedKernel, clampping, border, luma);
+    };
+    if (edges) {
+        ApplyEdgeMap(filter, 1);
+    } else {
+        ApplyInSelection(filter, 1);
+    }
+    recipe.AddFilter(invertedKernel, clampping, border, luma);
+    profiler.EndPhase();
     UpdateParameters();
     ShowImage();
+    FinishOperation();
+}
+
+void ImageEditingManager::ApplyGradient(int weight, bool l2, int border) {
+    profiler.BeginOperation("Gradient");
+    profiler.BeginPhase("kernel");
+
+    // Edge maps are grey, like the single-kernel edge filters, taken from the luma as it is read
+    bool luma = !grey;
+
+    ApplyEdgeMap([weight, l2, border, luma](const cv::Mat &src, cv::Mat &dst) {
+        Gradient(src, dst, weight, l2, border, luma);
+    }, 1);
+    recipe.AddGradient(weight, l2, border, luma);
+    profiler.EndPhase();
+    UpdateParameters();
+    ShowImage();
+    FinishOperation();
+}
+
+void ImageEditingManager::ApplyCanny(double low, double high, int border) {
+    profiler.BeginOperation("Canny");
+    profiler.BeginPhase("kernel");
+
+    // Non-maximum suppression reads the gradient one pixel away, which reads one more
+    ApplyEdgeMap([low, high, border](const cv::Mat &src, cv::Mat &dst) {
+        Canny(src, dst, low, high, border);
+    }, 2);
+    recipe.AddCanny(low, high, border);
+    profiler.EndPhase();
+    UpdateParameters();
+    ShowImage();
+    FinishOperation();
+}
+
+void ImageEditingManager::ApplyMedian(int radius, int border) {
+    profiler.BeginOperation("Median");
+    profiler.BeginPhase("kernel");
+    ApplyInSelection([radius, border](const cv::Mat &src, cv::Mat &dst) {
+        Median(src, dst, radius, border);
+    }, radius);
+    recipe.AddMedian(radius, border);
+    profiler.EndPhase();
+    UpdateParameters();
+    ShowImage();
+    FinishOperation();
+}
+
+void ImageEditingManager::ApplyBilateral(int spatial, double range) {
+    profiler.BeginOperation("Bilateral");
+    profiler.BeginPhase("kernel");
+    // The grid blur reaches about two cells away
+    ApplyInSelection([spatial, range](const cv::Mat &src, cv::Mat &dst) {
+        Bilateral(src, dst, spatial, range);
+    }, spatial*2);
+    recipe.AddBilateral(spatial, range);
+    profiler.EndPhase();
+    UpdateParameters();
+    ShowImage();
+    FinishOperation();
+}
+
+void ImageEditingManager::ApplyGaussian(double sigma, int border) {
+    profiler.BeginOperation("Gaussian blur");
+    profiler.BeginPhase("kernel");
+    ApplyInSelection([sigma, border](const cv::Mat &src, cv::Mat &dst) {
+        Gaussian(src, dst, sigma, border);
+    }, GaussianMargin(sigma));
+    recipe.AddGaussian(sigma, border);
+    profiler.EndPhase();
+    UpdateParameters();
+    ShowImage();
+    FinishOperation();
+}
+
+// Unlike the high-pass kernels, sharpening keeps the colours
+void ImageEditingManager::ApplyUnsharp(double amount, double sigma, double threshold, int border) {
+    profiler.BeginOperation("Unsharp mask");
+    profiler.BeginPhase("kernel");
+    ApplyInSelection([amount, sigma, threshold, border](const cv::Mat &src, cv::Mat &dst) {
+        UnsharpMask(src, dst, amount, sigma, threshold, border);
+    }, UnsharpMargin(sigma));
+    recipe.AddUnsharp(amount, sigma, threshold, border);
+    profiler.EndPhase();
+    UpdateParameters();
+    ShowImage();
+    FinishOperation();
 }
 
 
 // Histogram functions:
+void ImageEditingManager::SetHistogramPanel(HistogramPanel *newPanel) {
+    histogramPanel = newPanel;
+}
+
+void ImageEditingManager::SetLiveHistogram(HistogramPanel *newPanel) {
+    liveHistogram = newPanel;
+    liveHistogram->ShowHistogram(currentImg, grey, "Live histogram");
+}
+
 void ImageEditingManager::ShowHistogram() {
-    if (!grey) {
-        parameterBuffer = GreyScale(parameterBuffer);
-        grey = true;
-        UpdateParameters();
-        ShowImage();
-    }
-    DrawBarHistogram(Frequencies(currentImg, 0), "Current histogram");
+    profiler.BeginOperation("Show histogram");
+    histogramPanel->ShowHistogram(currentImg, grey, "Current histogram");
+    FinishOperation();
 }
 
 void ImageEditingManager::EqualizeImgHistogram() {
-    if (grey) {
-        DrawBarHistogram(Frequencies(currentImg, 0), "Previous frequencies");
-    } else {
-        DrawLineHistogram(currentImg, "Previous frequencies");
-    }
-   
-    parameterBuffer = Equalization(parameterBuffer);
+    // The panel counts the previous frequencies from this header in the background
+    cv::Mat before = currentImg;
+
+    profiler.BeginOperation("Equalize histogram");
+    profiler.BeginPhase("kernel");
+    ApplyInSelection([](const cv::Mat &src, cv::Mat &dst) {Equalization(src, dst);}, 0);
+    recipe.Add(Recipe::Equalize);
+    profiler.EndPhase();
     UpdateParameters();
     ShowImage();
 
-    if (grey) {
-        DrawBarHistogram(Frequencies(currentImg, 0), "Equalized frequencies");
-    } else {
-        DrawLineHistogram(currentImg, "Equalized frequencies");
-    }
+    histogramPanel->ShowComparison(before, currentImg, grey, "Equalized frequencies");
+    FinishOperation();
 }
 
 void ImageEditingManager::EqualizeTroughLAB() {
-    DrawLineHistogram(currentImg, "Previous frequencies");
-   
-    parameterBuffer = Lab(parameterBuffer);
+    cv::Mat before = currentImg;
+
+    profiler.BeginOperation("L*a*b* equalization");
+    profiler.BeginPhase("kernel");
+    ApplyInSelection([](const cv::Mat &src, cv::Mat &dst) {Lab(src, dst);}, 0);
+    recipe.Add(Recipe::LabEqualize);
+    profiler.EndPhase();
     UpdateParameters();
     ShowImage();
 
-    DrawLineHistogram(currentImg, "Equalized frequencies");
+    histogramPanel->ShowComparison(before, currentImg, grey, "Equalized frequencies");
+    FinishOperation();
 }
 
 
+void ImageEditingManager::EqualizeAdaptive() {
+    cv::Mat before = currentImg;
+
+    profiler.BeginOperation("Adaptive equalization");
+    profiler.BeginPhase("kernel");
+    ApplyInSelection([this](const cv::Mat &src, cv::Mat &dst) {
+        AdaptiveEqualization(src, dst, grey, cv::Size(ADAPTIVE_TILES, ADAPTIVE_TILES), ADAPTIVE_CLIP_LIMIT);
+    }, 0);
+    recipe.Add(Recipe::AdaptiveEqualize, ADAPTIVE_TILES, ADAPTIVE_TILES, ADAPTIVE_CLIP_LIMIT);
+    profiler.EndPhase();
+    UpdateParameters();
+    ShowImage();
+
+    histogramPanel->ShowComparison(before, currentImg, grey, "Equalized frequencies");
+    FinishOperation();
+}
+
 // Image parameters:
 void ImageEditingManager::AdjustQuantization(int numShades) {
+    profiler.BeginOperation("Quantization");
+    // Quantization is a parameter of the whole image
+    ClearSelection();
     lastQuantity = numShades;
     quantized = true;
+    recipe.SetQuantization(numShades);
     if (!grey) {
-        parameterBuffer = GreyScale(parameterBuffer);
-        grey = true;
+        profiler.BeginPhase("kernel");
+        GreyParameterBuffer();
+        profiler.EndPhase();
     }
+    dirty = FullFrame();
     UpdateParameters();
     ShowImage();
+    FinishOperation();
 }
 
 void ImageEditingManager::AdjustBrightness(int bias) {
-    lastBrightness = bias;
-    bright = true;
+    profiler.BeginOperation("Brightness");
+    // A selection has the adjustment baked in, the whole image keeps it as a live parameter
+    if (HasSelection()) {
+        profiler.BeginPhase("kernel");
+        selectionBias = bias;
+        ApplySelectionTone();
+        profiler.EndPhase();
+    } else {
+        lastBrightness = bias;
+        bright = true;
+        recipe.SetBrightness(bias);
+        dirty = FullFrame();
+    }
     UpdateParameters();
     ShowImage();
+    FinishOperation();
 }
 
 void ImageEditingManager::AdjustContrast(float gain) {
-    lastContrast = gain;
-    contrast = true;
+    profiler.BeginOperation("Contrast");
+    if (HasSelection()) {
+        profiler.BeginPhase("kernel");
+        selectionGain = gain;
+        ApplySelectionTone();
+        profiler.EndPhase();
+    } else {
+        lastContrast = gain;
+        contrast = true;
+        recipe.SetContrast(gain);
+        dirty = FullFrame();
+    }
     UpdateParameters();
     ShowImage();
+    FinishOperation();
 }
 
 // Reset and save
 void ImageEditingManager::Reset() {
-    parameterBuffer = resetBuffer.clone();
-    currentImg = resetBuffer.clone();
+    profiler.BeginOperation("Reset");
+    parameterBuffer = PooledClone(resetBuffer);
+    currentImg = PooledClone(resetBuffer);
+    edgeView.release();
+    ClearSelection();
+    dirty = FullFrame();
     Resize();
 
     quantized = false;
-    grey = false;
+    edited = false;
+    recipe.Clear();
+    grey = resetGrey;
     bright = false;
     contrast = false;
     ShowImage();
+    FinishOperation();
+}
+
+
+// Profiling:
+void ImageEditingManager::SetProfileLabel(QLabel *newLabel) {
+    profileLabel = newLabel;
+}
+
+void ImageEditingManager::ToggleProfilePanel() {
+    if (profileLabel->isVisible()) {
+        profileLabel->hide();
+    } else {
+        profileLabel->setText(QString::fromStdString(profiler.Summary(PROFILE_OPERATIONS)));
+        profileLabel->raise();
+        profileLabel->show();
+    }
+}
+
+void ImageEditingManager::ExportTrace() {
+    if (!profiler.ExportChromeTrace("DuckyShop_trace.json")) {
+        std::cerr << "Failed to write DuckyShop_trace.json" << std::endl;
+    }
 }
\ No newline at end of file
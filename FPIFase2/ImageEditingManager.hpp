@@ -2,8 +2,14 @@
 #define IMAGEEDITINGMANAGER_HPP
 
 #include <opencv2/opencv.hpp>
+#include <functional>
 #include <QLabel>
+#include <QPixmap>
 #include <QWidget>
+#include "Profiler.hpp"
+#include "HistogramPanel.hpp"
+#include "Recipe.hpp"
+#include "SelectionTool.hpp"
 
 class ImageEditingManager {
 
@@ -11,11 +17,32 @@ private:
     cv::Mat currentImg;
     cv::Mat parameterBuffer;
     cv::Mat resetBuffer;
+    /* Whole-image edge maps (luma filters, Gradient, Canny) derived from parameterBuffer,
+    which keeps its colours until Greyscale or another operation commits the map */
+    cv::Mat edgeView;
+    // Operations apply inside selection (and selectionMask) when there is one
+    cv::Rect selection;
+    cv::Mat selectionMask;
+    // Selection pixels before its brightness and contrast, which are applied to them once
+    cv::Mat selectionBase;
+    int selectionBias = 0;
+    float selectionGain = 1;
+    // Area changed since the last ShowImage, empty means everything
+    cv::Rect dirty;
+    QPixmap shownPixmap;
     int minHeight;
     QWidget *window;
     QLabel *imgLabel;
     QLabel *titleLabel;
+    QLabel *profileLabel = nullptr;
+    HistogramPanel *histogramPanel = nullptr;
+    HistogramPanel *liveHistogram = nullptr;
+    SelectionTool *selectionTool = nullptr;
+    Profiler profiler;
+    Recipe recipe;
     bool grey, 
+         resetGrey,
+         edited = false,
          quantized = false, 
          bright = false,
          contrast = false;
@@ -23,20 +50,41 @@ private:
         lastBrightness = 0;
     float lastContrast = 0;
 
+    void FinishOperation();
+    void GreyParameterBuffer();
+    void ApplyInSelection(const std::function<void(const cv::Mat&, cv::Mat&)> &kernel, int margin);
+    void ApplyEdgeMap(const std::function<void(const cv::Mat&, cv::Mat&)> &kernel, int margin);
+    void CommitEdgeView();
+    void ApplySelectionTone();
+    void DropSelectionTone();
+    cv::Rect FullFrame();
+
 public:
     // Init:
-    ImageEditingManager(cv::Mat newImg);
+    /* workingDepth is CV_8U, CV_16U or CV_32F, newImg is converted to it (and split into planes if
+    planar). -1 keeps the depth of newImg. */
+    ImageEditingManager(cv::Mat newImg, int workingDepth = -1, bool planar = false);
 
     // Get, set, others:
     void ShowImage();
+    void ShowOriginal(QLabel *label);
     void UpdateParameters();
     void SetTitleLabel(QLabel *newLabel);
     void SetImgLabel(QLabel *newLabel);
     void SetWindow(QWidget *newWindow);
     void SetMinHeight(int newHeight);
     bool GetGreyFlag();
+    bool IsEdited();
+    cv::Size GetOriginalSize();
+    const Recipe &GetRecipe();
     void Resize();
 
+    // Selection:
+    void SetSelectionTool(SelectionTool *newTool);
+    void SetSelection(cv::Rect newSelection, const cv::Mat &newMask);
+    void ClearSelection();
+    bool HasSelection();
+
     // Image operations:
     void MirrorHorizontally();
     void MirrorVertically();
@@ -47,12 +95,21 @@ public:
     void Rotate();
 
     // Image filters:
-    void ApplyFilter(double kernel[3][3], bool clampping);
+    void ApplyFilter(double kernel[3][3], bool clampping, int border = cv::BORDER_REPLICATE);
+    void ApplyGradient(int weight, bool l2, int border = cv::BORDER_REPLICATE);
+    void ApplyCanny(double low, double high, int border = cv::BORDER_REPLICATE);
+    void ApplyMedian(int radius, int border = cv::BORDER_REPLICATE);
+    void ApplyBilateral(int spatial, double range);
+    void ApplyGaussian(double sigma, int border = cv::BORDER_REPLICATE);
+    void ApplyUnsharp(double amount, double sigma, double threshold, int border = cv::BORDER_REPLICATE);
 
     // Histogram functions:
+    void SetHistogramPanel(HistogramPanel *newPanel);
+    void SetLiveHistogram(HistogramPanel *newPanel);
     void ShowHistogram();
     void EqualizeImgHistogram();
     void EqualizeTroughLAB();
+    void EqualizeAdaptive();
 
     // Image parameters:
     void AdjustQuantization(int numShades);
@@ -62,6 +119,11 @@ public:
     // Reset and save
     void Reset();
     void Save();
+
+    // Profiling:
+    void SetProfileLabel(QLabel *newLabel);
+    void ToggleProfilePanel();
+    void ExportTrace();
 };
 
 #endif
\ No newline at end of file
@@ -2,395 +2,2252 @@
 #include <iostream>
 #include <opencv2/highgui.hpp>
 #include <cstring>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <filesystem>
 #include "Histogram.hpp"
+#include "BufferPool.hpp"
+#include "Simd.hpp"
+#include "Pixel.hpp"
 
-bool IsGrey(cv::Mat img) {
-    int rows=img.rows, columns=img.cols;
-    cv::Vec3b pixelBuffer;
-    for (int i=0;i<rows;i++) {
-        for (int j=0;j<rows;j++) {
-            pixelBuffer = img.at<cv::Vec3b>(i,j);
-            if (pixelBuffer[0] != pixelBuffer[1]) {return false;}
-            if (pixelBuffer[1] != pixelBuffer[2]) {return false;}
-        }
+namespace fs = std::filesystem;
+
+// Pixels per chunk of fused colour-space work (about 48KB of BGR)
+#define LAB_CHUNK_PIXELS 16384
+
+// Layout:
+bool IsPlanar(const cv::Mat &img) {
+    return img.dims == 3;
+}
+
+cv::Size ImageSize(const cv::Mat &img) {
+    return IsPlanar(img) ? cv::Size(img.size[2], img.size[1]) : img.size();
+}
+
+int ImageChannels(const cv::Mat &img) {
+    return IsPlanar(img) ? img.size[0] : img.channels();
+}
+
+// 2-D header of plane k, valid while planar is alive
+static cv::Mat Plane(const cv::Mat &planar, int k) {
+    return cv::Mat(planar.size[1], planar.size[2], planar.type(), const_cast<uchar*>(planar.ptr(k)), planar.step[1]);
+}
+
+static std::vector<cv::Mat> Planes(const cv::Mat &planar) {
+    std::vector<cv::Mat> planes(planar.size[0]);
+    int k;
+
+    for (k=0;k<planar.size[0];k++) {
+        planes[k] = Plane(planar, k);
     }
-    return true;
+    return planes;
 }
 
-cv::Mat InvertVertically(cv::Mat img) {
-    cv::Mat newImg = cv::Mat::zeros(img.size(), img.type());
-    int i;
-    int rows = img.rows;
-    int rowSize = img.step[0];
+void ToPlanar(const cv::Mat &img, cv::OutputArray dst) {
+    const int channels = img.channels();
+    std::vector<int> fromTo(channels*2);
+    int k;
 
-    for (i=0;i<rows;i++) {
-        memcpy(newImg.ptr(i), img.ptr(rows-i-1), rowSize);
+    if (IsPlanar(img)) {
+        ConvertDepth(img, dst, img.depth());
+        return;
     }
 
-    return newImg;
+    cv::Mat newImg = CreatePlanarOutput(dst, channels, img.size(), CV_MAKETYPE(img.depth(), 1), img, false);
+    std::vector<cv::Mat> planes = Planes(newImg);
+    for (k=0;k<channels;k++) {
+        fromTo[k*2] = k;
+        fromTo[k*2 + 1] = k;
+    }
+    cv::mixChannels(&img, 1, planes.data(), channels, fromTo.data(), channels);
 }
 
-cv::Mat InvertHorizontally(cv::Mat img) {
-    cv::Mat newImg = cv::Mat::zeros(img.size(), img.type());
-    cv::Mat columnBuffer;
-    int i;
-    int columns = img.cols;
+void ToInterleaved(const cv::Mat &img, cv::OutputArray dst) {
+    const int channels = ImageChannels(img);
+    std::vector<int> fromTo(channels*2);
+    int k;
 
+    if (!IsPlanar(img)) {
+        ConvertDepth(img, dst, img.depth());
+        return;
+    }
 
-    for(i=0;i<columns;i++) {
-        columnBuffer = img.col(i);
-        columnBuffer.copyTo(newImg.col(columns-i-1));
+    cv::Mat newImg = CreateOutput(dst, ImageSize(img), CV_MAKETYPE(img.depth(), channels), img, false);
+    std::vector<cv::Mat> planes = Planes(img);
+    for (k=0;k<channels;k++) {
+        fromTo[k*2] = k;
+        fromTo[k*2 + 1] = k;
     }
+    cv::mixChannels(planes.data(), channels, &newImg, 1, fromTo.data(), channels);
+}
+
+cv::Mat Region(const cv::Mat &img, cv::Rect rect) {
+    if (!IsPlanar(img)) {return img(rect);}
 
-    return newImg;
+    const cv::Range ranges[3] = {cv::Range::all(), cv::Range(rect.y, rect.y+rect.height), cv::Range(rect.x, rect.x+rect.width)};
+    return img(ranges);
 }
 
-cv::Mat GreyScale(cv::Mat img) {
-    cv::Mat newImg = cv::Mat::zeros(img.size(), img.type());
-    cv::Vec3b pixelBuffer;
-    uchar lumBuffer;
-    int i, j;
-    int rows=img.rows, columns=img.cols;
+cv::Mat Subsample(const cv::Mat &img, int step) {
+    const cv::Size size = ImageSize(img);
+    const int channels = ImageChannels(img);
+    const bool planar = IsPlanar(img);
+    cv::Mat sample((size.height + step-1) / step, (size.width + step-1) / step, CV_MAKETYPE(img.depth(), channels));
+    const size_t channelSize = CV_ELEM_SIZE1(img.type()), sampleSize = sample.elemSize();
+    int i, j, k;
 
-    for (i=0;i<rows;i++) {
-        for (j=0;j<columns;j++) {
-            pixelBuffer = img.at<cv::Vec3b>(i,j);
-            lumBuffer = uchar(0.114*pixelBuffer[0] + 0.587*pixelBuffer[1] + 0.299*pixelBuffer[2]);
-            pixelBuffer[0] = lumBuffer;
-            pixelBuffer[1] = pixelBuffer[0];
-            pixelBuffer[2] = pixelBuffer[1];
-            newImg.at<cv::Vec3b>(i,j) = pixelBuffer;
+    // Planes are gathered one at a time into their channel of the sample
+    for (k=0;k<(planar ? channels : 1);k++) {
+        const cv::Mat source = planar ? Plane(img, k) : img;
+        const size_t pixelSize = source.elemSize();
+        for (i=0;i<sample.rows;i++) {
+            const uchar *row = source.ptr(i*step);
+            uchar *sampleRow = sample.ptr(i) + k*channelSize;
+            for (j=0;j<sample.cols;j++) {
+                std::memcpy(sampleRow + j*sampleSize, row + size_t(j)*step*pixelSize, pixelSize);
+            }
         }
     }
+    return sample;
+}
+
+void CopyMasked(const cv::Mat &from, cv::Mat to, const cv::Mat &mask) {
+    int k;
 
-    return newImg;
+    if (!IsPlanar(from)) {
+        from.copyTo(to, mask);
+        return;
+    }
+    for (k=0;k<from.size[0];k++) {
+        Plane(from, k).copyTo(Plane(to, k), mask);
+    }
 }
 
-cv::Mat Negative(cv::Mat img) {
-    cv::Mat newImg = cv::Mat::zeros(img.size(), img.type());
-    cv::Vec3b pixelBuffer;
-    int i, j;
-    int rows=img.rows, columns=img.cols;
+void ApplyInRegion(cv::Mat &img, cv::Rect region, const cv::Mat &mask, int margin,
+                   const std::function<void(const cv::Mat&, cv::Mat&)> &kernel) {
+    const cv::Rect full(cv::Point(), ImageSize(img));
+    const cv::Rect original = region;
+    region &= full;
+    if (region.empty()) {return;}
+    // The mask covers the unclipped region, so it is clipped by the same amount
+    cv::Mat clippedMask = mask.empty() ? mask : mask(cv::Rect(region.tl() - original.tl(), region.size()));
 
-    for (i=0;i<rows;i++) {
-        for (j=0;j<columns;j++) {
-            pixelBuffer = img.at<cv::Vec3b>(i,j);
-            pixelBuffer[0] = 255 - pixelBuffer[0];
-            pixelBuffer[1] = 255 - pixelBuffer[1];
-            pixelBuffer[2] = 255 - pixelBuffer[2];
-            newImg.at<cv::Vec3b>(i,j) = pixelBuffer;
+    // Copy on write: pixels outside region are kept, so they must not be shared
+    if (!OwnsBuffer(img)) {
+        img = PooledClone(img);
+    }
+
+    // Neighbourhood kernels read margin pixels around region, but only region is written back
+    cv::Rect grown = cv::Rect(region.x-margin, region.y-margin, region.width+margin*2, region.height+margin*2) & full;
+    cv::Mat source = Region(img, grown);
+    bool inPlace = margin == 0 && clippedMask.empty();
+    cv::Mat out = inPlace ? source : cv::Mat();
+
+    kernel(source, out);
+    if (!inPlace || out.data != source.data) {
+        CopyMasked(Region(out, cv::Rect(region.tl() - grown.tl(), region.size())), Region(img, region), clippedMask);
+    }
+}
+
+/* Runs the single-channel version of a kernel on every plane of a planar image, into
+planes of the given size. With colourOnly, the alpha plane is copied instead. inPlace
+is the kernel's own. Returns false, doing nothing, for interleaved images. */
+template <typename Function>
+static bool ForEachPlane(const cv::Mat &img, cv::OutputArray dst, cv::Size size, bool inPlace, bool colourOnly,
+                         Function function) {
+    if (!IsPlanar(img)) {return false;}
+
+    cv::Mat src = img;
+    const int planes = src.size[0];
+    cv::Mat newImg = CreatePlanarOutput(dst, planes, size, src.type(), src, inPlace);
+    int k;
+
+    for (k=0;k<planes;k++) {
+        cv::Mat srcPlane = Plane(src, k);
+        cv::Mat newPlane = Plane(newImg, k);
+        if (colourOnly && k == 3) {
+            if (newPlane.data != srcPlane.data) {
+                srcPlane.copyTo(newPlane);
+            }
+        } else {
+            function(srcPlane, newPlane);
         }
     }
+    return true;
+}
+
+/* Kernels that mix channels (or weight them by alpha) run function on an interleaved
+copy of planar images, split back into dst. Returns false, doing nothing, for
+interleaved images. */
+template <typename Function>
+static bool ThroughInterleaved(const cv::Mat &img, cv::OutputArray dst, Function function) {
+    if (!IsPlanar(img)) {return false;}
 
-    return newImg;
+    cv::Mat packed;
+    ToInterleaved(img, packed);
+    function(packed);
+    cv::Mat newImg = CreatePlanarOutput(dst, packed.channels(), packed.size(), img.type(), img, true);
+    ToPlanar(packed, newImg);
+    return true;
 }
 
-cv::Mat Enlarge(cv::Mat img) {
-    cv::Vec3b pixelBuffer, neighboor1, neighboor2;
-    int i, j, k;
-    int colorBuffer;
-    int origRows=img.rows, origColumns=img.cols;
-    int newRows, newColumns;
+/* Histogram operations work on 256 bins, so wider images run function on an 8-bit
+copy that is widened back into dst. Returns false, doing nothing, for 8-bit images. */
+template <typename Function>
+static bool Through8Bit(const cv::Mat &img, cv::OutputArray dst, Function function) {
+    if (img.depth() == CV_8U) {return false;}
 
-    newRows = origRows * 2 - 1;
-    newColumns = origColumns * 2 - 1;
-    cv::Mat newImg = cv::Mat::zeros(newRows, newColumns, img.type());
-    
+    cv::Mat narrow;
+    ConvertDepth(img, narrow, CV_8U);
+    function(narrow);
+    cv::Mat newImg = CreateOutputLike(dst, img, img.type(), true);
+    ConvertDepth(narrow, newImg, img.depth());
+    return true;
+}
+
+// Grey means every pixel has equal channels, so the first coloured chunk ends the scan
+bool IsGrey(const cv::Mat &img) {
+    const int rows=img.rows, columns=img.cols;
+    const int stripes = RowStripes(rows);
+    std::atomic<bool> coloured(false);
+
+    // Planes are compared whole, each comparison is a straight vector loop
+    if (IsPlanar(img)) {
+        return img.size[0] < 3 || (cv::norm(Plane(img, 0), Plane(img, 1), cv::NORM_INF) == 0 &&
+                                   cv::norm(Plane(img, 1), Plane(img, 2), cv::NORM_INF) == 0);
+    }
+
+    if (img.channels() < 3) {return true;}
 
-    for (i=0;i<newRows;i+=2) {
-        for (j=0;j<newColumns;j+=2) {
-            newImg.at<cv::Vec3b>(i,j) = img.at<cv::Vec3b>(i/2,j/2);
+    DispatchPixel(img.type(), [&](auto format) {
+        typedef decltype(format) P;
+        typedef typename P::Vec Pixel;
+
+        if constexpr (P::Colours == 3) {
+            cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range) {
+                for (int stripe=range.start;stripe<range.end;stripe++) {
+                    cv::Range stripeRows = StripeRows(stripe, stripes, rows);
+                    for (int i=stripeRows.start;i<stripeRows.end && !coloured.load(std::memory_order_relaxed);i++) {
+                        const Pixel *row = img.ptr<Pixel>(i);
+                        int j = 0;
+#if CV_SIMD
+                        if constexpr (std::is_same<typename P::Type, uchar>::value && P::Channels == 3) {
+                            cv::v_uint8 blue, green, red;
+                            for (;j<=columns-SIMD_U8_LANES;j+=SIMD_U8_LANES) {
+                                cv::v_load_deinterleave(row[j].val, blue, green, red);
+                                if (cv::v_check_any((blue != green) | (green != red))) {
+                                    coloured = true;
+                                    return;
+                                }
+                            }
+                        }
+#endif
+                        for (;j<columns;j++) {
+                            if (row[j][0] != row[j][1] || row[j][1] != row[j][2]) {
+                                coloured = true;
+                                return;
+                            }
+                        }
+                    }
+                }
+            });
         }
+    });
+
+    return !coloured;
+}
+
+void InvertVertically(const cv::Mat &img, cv::OutputArray dst) {
+    if (ForEachPlane(img, dst, ImageSize(img), false, false, InvertVertically)) {return;}
+
+    cv::Mat src = img;
+    cv::Mat newImg = CreateOutput(dst, src.size(), src.type(), src, false);
+    int i;
+    int rows = src.rows;
+    size_t rowSize = src.cols * src.elemSize();
+
+    for (i=0;i<rows;i++) {
+        memcpy(newImg.ptr(i), src.ptr(rows-i-1), rowSize);
     }
+}
 
-    for (i=0;i<newRows;i+=2) {
-        for (j=1;j<newColumns;j+=2) {
-            neighboor1 = newImg.at<cv::Vec3b>(i,j-1);
-            neighboor2 = newImg.at<cv::Vec3b>(i,j+1);
+void InvertHorizontally(const cv::Mat &img, cv::OutputArray dst) {
+    if (ForEachPlane(img, dst, ImageSize(img), false, false, InvertHorizontally)) {return;}
 
-            for (k=0;k<3;k++) {
-                colorBuffer = (neighboor1[k] + neighboor2[k])/2;
-                pixelBuffer[k] = static_cast<unsigned char>(colorBuffer);
+    cv::Mat src = img;
+    cv::Mat newImg = CreateOutput(dst, src.size(), src.type(), src, false);
+    const int rows=src.rows, columns=src.cols;
+
+    DispatchPixel(src.type(), [&](auto format) {
+        typedef typename decltype(format)::Vec Pixel;
+        int i, j;
+
+        for (i=0;i<rows;i++) {
+            const Pixel *srcRow = src.ptr<Pixel>(i);
+            Pixel *newRow = newImg.ptr<Pixel>(i);
+            for (j=0;j<columns;j++) {
+                newRow[columns-j-1] = srcRow[j];
             }
+        }
+    });
+}
 
-            newImg.at<cv::Vec3b>(i,j) = pixelBuffer;
+/* Point operations work row by row, so the same row can be both source and destination.
+function maps one colour channel value, alpha is copied through. */
+template <typename P, typename Function>
+static void ColourRow(const typename P::Type *src, typename P::Type *dst, int columns, Function function) {
+    int j, k;
+
+    if constexpr (P::Channels == P::Colours) {
+        for (k=0;k<columns*P::Channels;k++) {
+            dst[k] = function(src[k]);
+        }
+    } else {
+        for (j=0;j<columns;j++) {
+            for (k=0;k<P::Colours;k++) {
+                dst[j*P::Channels + k] = function(src[j*P::Channels + k]);
+            }
+            dst[j*P::Channels + P::Colours] = src[j*P::Channels + P::Colours];
         }
     }
+}
 
-    for (i=1;i<newRows;i+=2) {
-        for (j=0;j<newColumns;j++) {
-            neighboor1 = newImg.at<cv::Vec3b>(i-1,j);
-            neighboor2 = newImg.at<cv::Vec3b>(i+1,j);
+/* Float colours times gain plus offset, alpha kept, like ColourRow: a vector of elements
+at a time, or of BGRA pixels deinterleaved so alpha goes back untouched. */
+template <typename P>
+static void AffineRow(const float *src, float *dst, int columns, float gain, float offset) {
+    int k = 0;
 
-            for (k=0;k<3;k++) {
-                colorBuffer = (neighboor1[k] + neighboor2[k])/2;
-                pixelBuffer[k] = static_cast<unsigned char>(colorBuffer);
+    if constexpr (P::Channels == P::Colours) {
+        const int elements = columns*P::Channels;
+#if CV_SIMD
+        const cv::v_float32 vGain = cv::vx_setall_f32(gain), vOffset = cv::vx_setall_f32(offset);
+        for (;k<=elements-cv::v_float32::nlanes;k+=cv::v_float32::nlanes) {
+            cv::v_store(dst + k, cv::v_muladd(cv::vx_load(src + k), vGain, vOffset));
+        }
+#endif
+        for (;k<elements;k++) {
+            dst[k] = src[k]*gain + offset;
+        }
+    } else {
+#if CV_SIMD
+        const cv::v_float32 vGain = cv::vx_setall_f32(gain), vOffset = cv::vx_setall_f32(offset);
+        for (;k<=columns-cv::v_float32::nlanes;k+=cv::v_float32::nlanes) {
+            cv::v_float32 b, g, r, a;
+            cv::v_load_deinterleave(src + k*4, b, g, r, a);
+            cv::v_store_interleave(dst + k*4, cv::v_muladd(b, vGain, vOffset), cv::v_muladd(g, vGain, vOffset),
+                                   cv::v_muladd(r, vGain, vOffset), a);
+        }
+#endif
+        for (;k<columns;k++) {
+            for (int c=0;c<P::Colours;c++) {
+                dst[k*4 + c] = src[k*4 + c]*gain + offset;
+            }
+            dst[k*4 + 3] = src[k*4 + 3];
+        }
+    }
+}
+
+// Carries alpha over when a colour operation writes a separate output
+static void CopyAlpha(const cv::Mat &from, cv::Mat &to) {
+    if (from.channels() == 4 && from.data != to.data) {
+        const int fromTo[] = {3, 3};
+        cv::mixChannels(&from, 1, &to, 1, fromTo, 1);
+    }
+}
+
+template <typename P>
+static void GreyScaleRow(const typename P::Vec *src, typename P::Vec *dst, int columns) {
+    typedef typename P::Type T;
+    T lumBuffer;
+    int j;
+
+    for (j=0;j<columns;j++) {
+        if constexpr (P::Colours == 1) {
+            dst[j] = src[j];
+        } else {
+            lumBuffer = T(0.114*src[j][0] + 0.587*src[j][1] + 0.299*src[j][2]);
+            dst[j][0] = lumBuffer;
+            dst[j][1] = lumBuffer;
+            dst[j][2] = lumBuffer;
+            if constexpr (P::Channels == 4) {
+                dst[j][3] = src[j][3];
             }
+        }
+    }
+}
+
+// Luma from the first three planes goes to all three, alpha is kept
+static void PlanarGreyScale(const cv::Mat &img, cv::Mat &newImg) {
+    const cv::Size size = ImageSize(img);
 
-            newImg.at<cv::Vec3b>(i,j) = pixelBuffer;
+    if (img.size[0] < 3) {
+        if (newImg.data != img.data) {
+            img.copyTo(newImg);
         }
+        return;
     }
+    if (img.size[0] == 4 && newImg.data != img.data) {
+        Plane(img, 3).copyTo(Plane(newImg, 3));
+    }
+
+    DispatchPixel(img.type(), [&](auto format) {
+        typedef typename decltype(format)::Type T;
+
+        cv::parallel_for_(cv::Range(0, size.height), [&](const cv::Range &range) {
+            for (int i=range.start;i<range.end;i++) {
+                const T *blue = img.ptr<T>(0, i), *green = img.ptr<T>(1, i), *red = img.ptr<T>(2, i);
+                T *outBlue = newImg.ptr<T>(0, i), *outGreen = newImg.ptr<T>(1, i), *outRed = newImg.ptr<T>(2, i);
+                for (int j=0;j<size.width;j++) {
+                    T lumBuffer = T(0.114*blue[j] + 0.587*green[j] + 0.299*red[j]);
+                    outBlue[j] = lumBuffer;
+                    outGreen[j] = lumBuffer;
+                    outRed[j] = lumBuffer;
+                }
+            }
+        });
+    });
+}
+
+void GreyScale(const cv::Mat &img, cv::OutputArray dst) {
+    if (IsPlanar(img)) {
+        cv::Mat newImg = CreateOutputLike(dst, img, img.type(), true);
+        PlanarGreyScale(img, newImg);
+        return;
+    }
+
+    cv::Mat newImg = CreateOutput(dst, img.size(), img.type(), img, true);
+    const int rows=img.rows, columns=img.cols;
+
+    DispatchPixel(img.type(), [&](auto format) {
+        typedef decltype(format) P;
+        int i;
+
+        for (i=0;i<rows;i++) {
+            GreyScaleRow<P>(img.ptr<typename P::Vec>(i), newImg.ptr<typename P::Vec>(i), columns);
+        }
+    });
+}
+
+void Negative(const cv::Mat &img, cv::OutputArray dst) {
+    if (ForEachPlane(img, dst, ImageSize(img), true, true, Negative)) {return;}
 
-    return newImg;
+    cv::Mat newImg = CreateOutput(dst, img.size(), img.type(), img, true);
+    const int rows=img.rows, columns=img.cols;
+
+    DispatchPixel(img.type(), [&](auto format) {
+        typedef decltype(format) P;
+        typedef typename P::Type T;
+        const T full = T(PixelMax<T>());
+        int i;
+
+        for (i=0;i<rows;i++) {
+            ColourRow<P>(img.ptr<T>(i), newImg.ptr<T>(i), columns, [full](T value) {
+                return T(full - value);
+            });
+        }
+    });
+}
+
+/* Resampling and filters weight the colours of BGRA pixels by their alpha (premultiplied),
+so the meaningless colour of transparent pixels does not bleed into their neighbours. */
+template <typename P>
+static typename P::Vec Midpoint(const typename P::Vec &a, const typename P::Vec &b) {
+    typedef typename P::Type T;
+    typedef typename P::Sum Sum;
+    typename P::Vec mid;
+    int k;
+
+    if constexpr (P::Channels == 4) {
+        double weight = double(a[3]) + b[3];
+        for (k=0;k<3;k++) {
+            mid[k] = weight > 0 ? T((double(a[k])*a[3] + double(b[k])*b[3]) / weight) : T(0);
+        }
+        mid[3] = T((Sum(a[3]) + b[3]) / 2);
+    } else {
+        for (k=0;k<P::Channels;k++) {
+            mid[k] = T((Sum(a[k]) + b[k]) / 2);
+        }
+    }
+    return mid;
 }
 
+void Enlarge(const cv::Mat &img, cv::OutputArray dst) {
+    const cv::Size size = ImageSize(img);
+    if (ImageChannels(img) == 4 && ThroughInterleaved(img, dst, [](cv::Mat &packed) {Enlarge(packed, packed);})) {return;}
+    if (ForEachPlane(img, dst, cv::Size(size.width*2 - 1, size.height*2 - 1), false, false, Enlarge)) {return;}
 
-cv::Mat Reduce(cv::Mat img, int sx, int sy) {
-    cv::Vec3b imgFragment[sx][sy], pixelBuffer;
-    int i, j, k, m, n, p, o;
-    int colorBuffer;
-    int origRows=img.rows, origColumns=img.cols;
+    cv::Mat src = img;
+    int origRows=src.rows, origColumns=src.cols;
+    int newRows, newColumns;
+
+    newRows = origRows * 2 - 1;
+    newColumns = origColumns * 2 - 1;
+    cv::Mat newImg = CreateOutput(dst, cv::Size(newColumns, newRows), src.type(), src, false);
+
+    DispatchPixel(src.type(), [&](auto format) {
+        typedef decltype(format) P;
+        typedef typename P::Vec Pixel;
+        int i, j;
+
+        // Even rows: original pixels, with the average of both neighbours in between
+        for (i=0;i<newRows;i+=2) {
+            const Pixel *srcRow = src.ptr<Pixel>(i/2);
+            Pixel *row = newImg.ptr<Pixel>(i);
+            for (j=0;j<newColumns;j+=2) {
+                row[j] = srcRow[j/2];
+            }
+            for (j=1;j<newColumns;j+=2) {
+                row[j] = Midpoint<P>(row[j-1], row[j+1]);
+            }
+        }
+
+        // Odd rows: average of the rows above and below
+        for (i=1;i<newRows;i+=2) {
+            const Pixel *above = newImg.ptr<Pixel>(i-1);
+            const Pixel *below = newImg.ptr<Pixel>(i+1);
+            Pixel *row = newImg.ptr<Pixel>(i);
+            for (j=0;j<newColumns;j++) {
+                row[j] = Midpoint<P>(above[j], below[j]);
+            }
+        }
+    });
+}
+
+
+void Reduce(const cv::Mat &img, cv::OutputArray dst, int sx, int sy) {
+    const cv::Size size = ImageSize(img);
+    if (ImageChannels(img) == 4 && ThroughInterleaved(img, dst, [sx, sy](cv::Mat &packed) {
+        Reduce(packed, packed, sx, sy);
+    })) {return;}
+    if (ForEachPlane(img, dst, cv::Size((size.width + sy - 1) / sy, (size.height + sx - 1) / sx), false, false,
+                     [sx, sy](const cv::Mat &plane, cv::Mat &newPlane) {Reduce(plane, newPlane, sx, sy);})) {return;}
+
+    cv::Mat src = img;
+    int origRows=src.rows, origColumns=src.cols;
     int newRows, newColumns;
 
     newRows = (origRows + sx -1) / sx;
     newColumns = (origColumns + sy -1) / sy;
-    cv::Mat newImg = cv::Mat::zeros(newRows, newColumns, img.type());
+    cv::Mat newImg = CreateOutput(dst, cv::Size(newColumns, newRows), src.type(), src, false);
 
-    for (i=0;i<newRows;i++) {
-        for (j=0;j<newColumns;j++) {
+    DispatchPixel(src.type(), [&](auto format) {
+        typedef decltype(format) P;
+        typedef typename P::Type T;
+        typedef typename P::Sum Sum;
+        typedef typename P::Vec Pixel;
+        // Premultiplied colour sums need more room than Sum
+        typedef typename std::conditional<P::Channels == 4, double, Sum>::type Accumulator;
+        int i, j, k, m, n;
 
-            m = 0;
-            while ((i*sx+m < origRows) && (m < sx)) {
-                n = 0;
-                while ((j*sy+n <= origColumns) && (n <= sy)) {
-                    imgFragment[m][n] = img.at<cv::Vec3b>(i*sx+m,j*sy+n);
-                    n++;
-                }
-                m++;
-            }
- 
-            for (k=0;k<3;k++) {
-                colorBuffer = 0;
-                for (p=0;p<m;p++) {
-                    for (o=0;o<n;o++) {
-                        colorBuffer += imgFragment[p][o][k];
+        for (i=0;i<newRows;i++) {
+            // Blocks on the last row and column may be cut by the image border
+            int blockRows = std::min(sx, origRows - i*sx);
+            Pixel *newRow = newImg.ptr<Pixel>(i);
+            for (j=0;j<newColumns;j++) {
+                int blockColumns = std::min(sy, origColumns - j*sy);
+                Accumulator colorBuffer[P::Channels] = {};
+
+                for (m=0;m<blockRows;m++) {
+                    const Pixel *row = src.ptr<Pixel>(i*sx+m) + j*sy;
+                    for (n=0;n<blockColumns;n++) {
+                        if constexpr (P::Channels == 4) {
+                            for (k=0;k<3;k++) {
+                                colorBuffer[k] += double(row[n][k]) * row[n][3];
+                            }
+                            colorBuffer[3] += row[n][3];
+                        } else {
+                            for (k=0;k<P::Channels;k++) {
+                                colorBuffer[k] += row[n][k];
+                            }
+                        }
                     }
                 }
 
-                pixelBuffer[k] = static_cast<unsigned char>(colorBuffer/(m*n));
+                if constexpr (P::Channels == 4) {
+                    for (k=0;k<3;k++) {
+                        newRow[j][k] = colorBuffer[3] > 0 ? T(colorBuffer[k] / colorBuffer[3]) : T(0);
+                    }
+                    newRow[j][3] = T(colorBuffer[3] / (blockRows*blockColumns));
+                } else {
+                    for (k=0;k<P::Channels;k++) {
+                        newRow[j][k] = T(colorBuffer[k] / (blockRows*blockColumns));
+                    }
+                }
             }
-
-            newImg.at<cv::Vec3b>(i,j) = pixelBuffer;
         }
-    }
-
-    return newImg;
+    });
 }
 
 
-cv::Mat Rotate90(cv::Mat img) {
-    int i, j;
-    int origRows=img.rows, origColumns=img.cols;
+void Rotate90(const cv::Mat &img, cv::OutputArray dst) {
+    const cv::Size size = ImageSize(img);
+    if (ForEachPlane(img, dst, cv::Size(size.height, size.width), false, false, Rotate90)) {return;}
+
+    cv::Mat src = img;
+    int origRows=src.rows, origColumns=src.cols;
     int newRows, newColumns;
 
     newRows = origColumns;
     newColumns = origRows;
-    cv::Mat newImg = cv::Mat::zeros(newRows, newColumns, img.type());
+    cv::Mat newImg = CreateOutput(dst, cv::Size(newColumns, newRows), src.type(), src, false);
+
+    // Clockwise: new row i is original column i, read from the bottom up
+    DispatchPixel(src.type(), [&](auto format) {
+        typedef typename decltype(format)::Vec Pixel;
+        int i, j;
 
-    for (i=0;i<newRows;i++) {
-        for (j=0;j<newColumns;j++) {
-            newImg.at<cv::Vec3b>(i,j) = img.at<cv::Vec3b>(newRows-1-j,i);
+        for (i=0;i<newRows;i++) {
+            Pixel *newRow = newImg.ptr<Pixel>(i);
+            for (j=0;j<newColumns;j++) {
+                newRow[j] = src.ptr<Pixel>(newColumns-1-j)[i];
+            }
         }
-    }
+    });
+}
+
+// Luma of one interleaved row (full scale 1.0, or the units of the row for scale 1), the weights of GreyScale
+template <typename P>
+static void LumaRow(const typename P::Vec *row, float *luma, int columns, double scale) {
+    int j;
 
-    return newImg;
+    for (j=0;j<columns;j++) {
+        if constexpr (P::Colours == 1) {
+            luma[j] = float(row[j][0] * scale);
+        } else {
+            luma[j] = float((0.114*row[j][0] + 0.587*row[j][1] + 0.299*row[j][2]) * scale);
+        }
+    }
 }
 
-cv::Mat Convolution(cv::Mat img, double kernel[3][3], bool clampping) {
-    cv::Mat newImg = cv::Mat::zeros(img.size(), img.type());
-    cv::Vec3b imgFragment[3][3], pixelBuffer;
-    double colorBuffer;
-    int i, j, k, m, n;
-    const int rows=img.rows, columns=img.cols;
+/* Streams the luma of a colour image (interleaved) for 3x3 neighbourhood operators:
+rowFunction(i, window, scratch) is called for every row, window holding the luma lines
+of rows i-1, i and i+1 in the units of src, each padded by one value per side taken by
+border (zero outside for BORDER_CONSTANT), and scratch a line of columns free values.
+The lines of a stripe sit in a ring of 3, so every source row is read once per stripe
+and no grey image is made. */
+template <typename P, typename Function>
+static void LumaWindows(const cv::Mat &src, int border, Function rowFunction) {
+    typedef typename P::Vec Pixel;
+    const int rows=src.rows, columns=src.cols;
+    const int stripes = RowStripes(rows);
+    const int first = cv::borderInterpolate(-1, columns, border);
+    const int last = cv::borderInterpolate(columns, columns, border);
+
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range) {
+        std::vector<float> ring(3*(columns+2)), scratch(columns);
 
-    for (i=1;i<rows-1;i++) {
-        for (j=1;j<columns-1;j++) {
+        // Padded luma line of row y into its ring slot
+        auto lumaLine = [&](int y) {
+            float *slot = &ring[(((y % 3) + 3) % 3) * (columns+2)];
+            int source = cv::borderInterpolate(y, rows, border);
+            if (source < 0) {
+                std::fill(slot, slot + columns+2, 0.f);
+                return;
+            }
+            LumaRow<P>(src.ptr<Pixel>(source), slot + 1, columns, 1);
+            slot[0] = first < 0 ? 0.f : slot[1+first];
+            slot[columns+1] = last < 0 ? 0.f : slot[1+last];
+        };
 
-            // Getting neighboor pixels
-            for (m=0;m<3;m++) {
-                for (n=0;n<3;n++) {
-                    imgFragment[m][n] = img.at<cv::Vec3b>(i-1+m,j-1+n);
+        for (int stripe=range.start;stripe<range.end;stripe++) {
+            cv::Range stripeRows = StripeRows(stripe, stripes, rows);
+            lumaLine(stripeRows.start-1);
+            lumaLine(stripeRows.start);
+            for (int i=stripeRows.start;i<stripeRows.end;i++) {
+                lumaLine(i+1);
+                const float *window[3];
+                for (int m=0;m<3;m++) {
+                    window[m] = &ring[((((i-1+m) % 3) + 3) % 3) * (columns+2)];
                 }
+                rowFunction(i, window, scratch.data());
             }
-            
-            // For each channel
+        }
+    });
+}
+
+/* Premultiplied 3x3 filter of one BGRA pixel. Alpha is filtered with the same kernel
+(normalized by its sum), and colours are divided back by it. Kernels that sum to zero,
+such as edge detectors, keep the centre alpha instead. Opaque images give the same
+result as filtering the colours alone. */
+template <typename P>
+static void ConvolvePremultiplied(const typename P::Vec *window[3], int j, const double kernel[3][3],
+                                  double kernelSum, double offset, typename P::Vec &out) {
+    typedef typename P::Type T;
+    double colorBuffer[3] = {0, 0, 0};
+    double alphaBuffer = 0, weight;
+    int k, m, n;
+
+    for (m=0;m<3;m++) {
+        for (n=0;n<3;n++) {
+            const typename P::Vec &pixel = window[m][j-1+n];
+            weight = kernel[m][n] * pixel[3];
             for (k=0;k<3;k++) {
-                // Get new value
-                colorBuffer = 0;
-                for (m=0;m<3;m++) {
-                    for (n=0;n<3;n++) {
-                        colorBuffer += static_cast<double>(imgFragment[m][n][k] * kernel[m][n]);
+                colorBuffer[k] += weight * pixel[k];
+            }
+            alphaBuffer += weight;
+        }
+    }
+
+    alphaBuffer = kernelSum != 0 ? alphaBuffer / kernelSum : double(window[1][j][3]);
+    for (k=0;k<3;k++) {
+        out[k] = ClampPixel<T>((alphaBuffer > 0 ? colorBuffer[k] / alphaBuffer : 0) + offset);
+    }
+    out[3] = ClampPixel<T>(alphaBuffer);
+}
+
+// 3x3 filter of pixel j of the middle window row, which must have both neighbours
+template <typename P>
+static void ConvolvePixel(const typename P::Vec *window[3], int j, const double kernel[3][3],
+                          double kernelSum, double offset, typename P::Vec &out) {
+    typedef typename P::Type T;
+    int k, m, n;
+
+    if constexpr (P::Channels == 4) {
+        ConvolvePremultiplied<P>(window, j, kernel, kernelSum, offset, out);
+        return;
+    }
+    for (k=0;k<P::Channels;k++) {
+        double colorBuffer = 0;
+        for (m=0;m<3;m++) {
+            for (n=0;n<3;n++) {
+                colorBuffer += static_cast<double>(window[m][j-1+n][k] * kernel[m][n]);
+            }
+        }
+        out[k] = ClampPixel<T>(colorBuffer + offset);
+    }
+}
+
+/* Border pixel (i, j): its neighbourhood is gathered through cv::borderInterpolate into
+a 3x3 patch, outside pixels being zero (transparent) for BORDER_CONSTANT, and then
+filtered like any interior pixel. */
+template <typename P>
+static void ConvolveBorderPixel(const cv::Mat &src, int i, int j, int border, const double kernel[3][3],
+                                double kernelSum, double offset, typename P::Vec &out) {
+    typedef typename P::Vec Pixel;
+    Pixel patch[3][3];
+    const Pixel *window[3] = {patch[0], patch[1], patch[2]};
+    int m, n, row, column;
+
+    for (m=0;m<3;m++) {
+        row = cv::borderInterpolate(i-1+m, src.rows, border);
+        for (n=0;n<3;n++) {
+            column = cv::borderInterpolate(j-1+n, src.cols, border);
+            patch[m][n] = row < 0 || column < 0 ? Pixel::all(0) : src.ptr<Pixel>(row)[column];
+        }
+    }
+    ConvolvePixel<P>(window, 1, kernel, kernelSum, offset, out);
+}
+
+void Convolution(const cv::Mat &img, cv::OutputArray dst, const double kernel[3][3], bool clampping, int border,
+                 bool luma) {
+    // Luma filtering reads every colour of a pixel at once, so it needs them interleaved
+    luma = luma && ImageChannels(img) >= 3;
+    auto convolve = [kernel, clampping, border, luma](cv::Mat &packed) {
+        Convolution(packed, packed, kernel, clampping, border, luma);
+    };
+    if ((luma || ImageChannels(img) == 4) && ThroughInterleaved(img, dst, convolve)) {return;}
+    if (ForEachPlane(img, dst, ImageSize(img), false, false, [kernel, clampping, border](const cv::Mat &plane, cv::Mat &newPlane) {
+        Convolution(plane, newPlane, kernel, clampping, border);
+    })) {return;}
+
+    CV_Assert(border == cv::BORDER_REPLICATE || border == cv::BORDER_REFLECT_101 ||
+              border == cv::BORDER_WRAP || border == cv::BORDER_CONSTANT);
+    cv::Mat src = img;
+    cv::Mat newImg = CreateOutput(dst, src.size(), src.type(), src, false);
+    const int rows=src.rows, columns=src.cols;
+
+    DispatchPixel(src.type(), [&](auto format) {
+        typedef decltype(format) P;
+        typedef typename P::Type T;
+        typedef typename P::Vec Pixel;
+        // Clampping shifts the result to middle grey, for signed responses such as edges
+        const double offset = clampping ? PixelMid<T>() : 0;
+        // Rows that are first or last have no interior, their every pixel is a border one
+        const int lastColumn = columns > 1 ? columns-1 : 0;
+        double kernelSum = 0;
+
+        for (int m=0;m<3;m++) {
+            for (int n=0;n<3;n++) {
+                kernelSum += kernel[m][n];
+            }
+        }
+
+        // The filtered luma line is made first, then written to every colour, alpha is kept
+        if (luma) {
+            LumaWindows<P>(src, border, [&](int i, const float *window[3], float *filtered) {
+                const Pixel *row = src.ptr<Pixel>(i);
+                Pixel *newRow = newImg.ptr<Pixel>(i);
+                for (int j=0;j<columns;j++) {
+                    double colorBuffer = 0;
+                    for (int m=0;m<3;m++) {
+                        for (int n=0;n<3;n++) {
+                            colorBuffer += window[m][j+n] * kernel[m][n];
+                        }
                     }
+                    filtered[j] = float(colorBuffer + offset);
                 }
-                // Do clampping if requested
-                if (clampping) {
-                    colorBuffer += 127;
+                for (int j=0;j<columns;j++) {
+                    T value = ClampPixel<T>(filtered[j]);
+                    for (int c=0;c<P::Colours;c++) {
+                        newRow[j][c] = value;
+                    }
+                    if constexpr (P::Channels == 4) {
+                        newRow[j][3] = row[j][3];
+                    }
                 }
-                // Correct value
-                if (colorBuffer > 255) {
-                    colorBuffer = 255;
-                } else if (colorBuffer<0) {
-                    colorBuffer = 0;
+            });
+            return;
+        }
+
+        /* src and newImg never share pixels here, so rows are independent. The interior
+        reads its neighbours unchecked, and only the first and last columns go through
+        the border path. */
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+            for (int i=range.start;i<range.end;i++) {
+                Pixel *newRow = newImg.ptr<Pixel>(i);
+                if (i == 0 || i == rows-1) {
+                    for (int j=0;j<columns;j++) {
+                        ConvolveBorderPixel<P>(src, i, j, border, kernel, kernelSum, offset, newRow[j]);
+                    }
+                    continue;
+                }
+
+                const Pixel *window[3] = {src.ptr<Pixel>(i-1), src.ptr<Pixel>(i), src.ptr<Pixel>(i+1)};
+                ConvolveBorderPixel<P>(src, i, 0, border, kernel, kernelSum, offset, newRow[0]);
+                for (int j=1;j<columns-1;j++) {
+                    ConvolvePixel<P>(window, j, kernel, kernelSum, offset, newRow[j]);
+                }
+                ConvolveBorderPixel<P>(src, i, lastColumn, border, kernel, kernelSum, offset, newRow[lastColumn]);
+            }
+        });
+    });
+}
+
+/* Sobel (weight 2) or Prewitt (weight 1) gradient of elements [from, to) of a row, Gx and Gy
+from the same 3x3 reads. step is the distance between neighbouring pixels, so every
+channel of an interleaved row is done at once. The magnitude is divided by 2 + weight,
+which makes a full step along one axis full scale, and written to out[e - from]; the
+direction in radians, when angle is given, to angle[e - from]. */
+template <typename T>
+static void GradientRow(const T *above, const T *row, const T *below, int from, int to, int step,
+                        int weight, bool l2, T *out, float *angle) {
+    const double divisor = 2 + weight;
+    double gx, gy, magnitude;
+    int e = from;
+
+#if CV_SIMD
+    /* 8-bit L1 in 16-bit lanes: |Gx| + |Gy| is at most 2040, and the rounded up reciprocal
+    truncates like the scalar division */
+    if constexpr (std::is_same<T, uchar>::value) {
+        if (!l2 && !angle) {
+            const cv::v_int16 w = cv::vx_setall_s16(short(weight));
+            const cv::v_uint16 reciprocal = cv::vx_setall_u16(ushort((65536 + 1 + weight) / (2 + weight)));
+            for (;e<=to-SIMD_U16_LANES;e+=SIMD_U16_LANES) {
+                cv::v_int16 aboveLeft = cv::v_reinterpret_as_s16(cv::vx_load_expand(above + e - step));
+                cv::v_int16 aboveCentre = cv::v_reinterpret_as_s16(cv::vx_load_expand(above + e));
+                cv::v_int16 aboveRight = cv::v_reinterpret_as_s16(cv::vx_load_expand(above + e + step));
+                cv::v_int16 left = cv::v_reinterpret_as_s16(cv::vx_load_expand(row + e - step));
+                cv::v_int16 right = cv::v_reinterpret_as_s16(cv::vx_load_expand(row + e + step));
+                cv::v_int16 belowLeft = cv::v_reinterpret_as_s16(cv::vx_load_expand(below + e - step));
+                cv::v_int16 belowCentre = cv::v_reinterpret_as_s16(cv::vx_load_expand(below + e));
+                cv::v_int16 belowRight = cv::v_reinterpret_as_s16(cv::vx_load_expand(below + e + step));
+                cv::v_int16 vx = (aboveRight - aboveLeft) + cv::v_mul_wrap(right - left, w) + (belowRight - belowLeft);
+                cv::v_int16 vy = (belowLeft + cv::v_mul_wrap(belowCentre, w) + belowRight) -
+                                 (aboveLeft + cv::v_mul_wrap(aboveCentre, w) + aboveRight);
+                cv::v_pack_store(out + e - from, cv::v_mul_hi(cv::v_abs(vx) + cv::v_abs(vy), reciprocal));
+            }
+        }
+    }
+    /* Float, the working depth and the luma of the luma modes: either norm in float lanes.
+    The direction has no intrinsic, it is taken from the stored lanes of Gx and Gy. */
+    if constexpr (std::is_same<T, float>::value) {
+        const cv::v_float32 w = cv::vx_setall_f32(float(weight)), vDivisor = cv::vx_setall_f32(float(divisor));
+        float gxLanes[cv::v_float32::nlanes], gyLanes[cv::v_float32::nlanes];
+        for (;e<=to-cv::v_float32::nlanes;e+=cv::v_float32::nlanes) {
+            cv::v_float32 aboveLeft = cv::vx_load(above + e - step), aboveRight = cv::vx_load(above + e + step);
+            cv::v_float32 belowLeft = cv::vx_load(below + e - step), belowRight = cv::vx_load(below + e + step);
+            cv::v_float32 vx = (aboveRight - aboveLeft) + (cv::vx_load(row + e + step) - cv::vx_load(row + e - step)) * w +
+                               (belowRight - belowLeft);
+            cv::v_float32 vy = (belowLeft + cv::vx_load(below + e) * w + belowRight) -
+                               (aboveLeft + cv::vx_load(above + e) * w + aboveRight);
+            cv::v_float32 norm = l2 ? cv::v_sqrt(cv::v_muladd(vx, vx, vy * vy)) : cv::v_abs(vx) + cv::v_abs(vy);
+            cv::v_store(out + e - from, norm / vDivisor);
+            if (angle) {
+                cv::v_store(gxLanes, vx);
+                cv::v_store(gyLanes, vy);
+                for (int l=0;l<cv::v_float32::nlanes;l++) {
+                    angle[e-from+l] = std::atan2(gyLanes[l], gxLanes[l]);
                 }
-                // Save
-                pixelBuffer[k] = static_cast<unsigned char>(colorBuffer);
             }
-            
-            // Compose new image
-            newImg.at<cv::Vec3b>(i,j) = pixelBuffer;
         }
     }
+#endif
+    for (;e<to;e++) {
+        gx = double(above[e+step]) - above[e-step] + weight * (double(row[e+step]) - row[e-step]) +
+             double(below[e+step]) - below[e-step];
+        gy = double(below[e-step]) + weight * double(below[e]) + below[e+step] -
+             (double(above[e-step]) + weight * double(above[e]) + above[e+step]);
+        magnitude = l2 ? std::sqrt(gx*gx + gy*gy) : std::abs(gx) + std::abs(gy);
+        out[e-from] = ClampPixel<T>(magnitude / divisor);
+        if (angle) {
+            angle[e-from] = float(std::atan2(gy, gx));
+        }
+    }
+}
 
-    return newImg;
+// Border pixel (i, j), from a 3x3 patch gathered like ConvolveBorderPixel
+template <typename P>
+static void GradientBorderPixel(const cv::Mat &src, int i, int j, int border, int weight, bool l2,
+                                typename P::Vec &out, float *angle) {
+    typedef typename P::Type T;
+    typedef typename P::Vec Pixel;
+    Pixel patch[3][3];
+    int m, n, row, column;
+
+    for (m=0;m<3;m++) {
+        row = cv::borderInterpolate(i-1+m, src.rows, border);
+        for (n=0;n<3;n++) {
+            column = cv::borderInterpolate(j-1+n, src.cols, border);
+            patch[m][n] = row < 0 || column < 0 ? Pixel::all(0) : src.ptr<Pixel>(row)[column];
+        }
+    }
+    GradientRow<T>(patch[0][0].val, patch[1][0].val, patch[2][0].val, P::Channels, P::Channels*2, P::Channels,
+                   weight, l2, out.val, angle);
 }
 
-cv::Mat Equalization(cv::Mat img) {
-    cv::Mat newImg = cv::Mat::zeros(img.size(), img.type());
-    cv::Vec3b oldPixel, newPixel;
-    int i, j;
-    int rows=img.rows, columns=img.cols;
-    int totalOfPixels = rows*columns;
+void Gradient(const cv::Mat &img, cv::OutputArray dst, int weight, bool l2, int border, bool luma,
+              cv::OutputArray direction) {
+    luma = luma && ImageChannels(img) >= 3;
+    // Planar images keep their layout, unless the direction or the luma is asked for
+    auto gradient = [weight, l2, border, luma, &direction](cv::Mat &packed) {
+        Gradient(packed, packed, weight, l2, border, luma, direction);
+    };
+    if ((luma || direction.needed()) && ThroughInterleaved(img, dst, gradient)) {return;}
+    if (ForEachPlane(img, dst, ImageSize(img), false, true, [weight, l2, border](const cv::Mat &plane, cv::Mat &newPlane) {
+        Gradient(plane, newPlane, weight, l2, border);
+    })) {return;}
+
+    CV_Assert(border == cv::BORDER_REPLICATE || border == cv::BORDER_REFLECT_101 ||
+              border == cv::BORDER_WRAP || border == cv::BORDER_CONSTANT);
+    cv::Mat src = img;
+    cv::Mat newImg = CreateOutput(dst, src.size(), src.type(), src, false);
+    cv::Mat angles;
+    const int rows=src.rows, columns=src.cols, channels=src.channels();
+
+    if (direction.needed()) {
+        direction.create(src.size(), CV_MAKETYPE(CV_32F, luma ? 1 : channels));
+        angles = direction.getMat();
+    }
+
+    DispatchPixel(src.type(), [&](auto format) {
+        typedef decltype(format) P;
+        typedef typename P::Type T;
+        typedef typename P::Vec Pixel;
+        const int lastColumn = columns > 1 ? columns-1 : 0;
+
+        // The gradient of the luma, every padded line having its borders, goes to every colour
+        if (luma) {
+            LumaWindows<P>(src, border, [&](int i, const float *window[3], float *magnitude) {
+                Pixel *newRow = newImg.ptr<Pixel>(i);
+                GradientRow<float>(window[0], window[1], window[2], 1, columns+1, 1, weight, l2,
+                                   magnitude, angles.empty() ? nullptr : angles.ptr<float>(i));
+                for (int j=0;j<columns;j++) {
+                    T value = ClampPixel<T>(magnitude[j]);
+                    for (int c=0;c<P::Colours;c++) {
+                        newRow[j][c] = value;
+                    }
+                }
+            });
+            return;
+        }
+
+        // Same split as Convolution: unchecked interior, border path for the outer pixels
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+            for (int i=range.start;i<range.end;i++) {
+                Pixel *newRow = newImg.ptr<Pixel>(i);
+                float *angleRow = angles.empty() ? nullptr : angles.ptr<float>(i);
+                if (i == 0 || i == rows-1) {
+                    for (int j=0;j<columns;j++) {
+                        GradientBorderPixel<P>(src, i, j, border, weight, l2, newRow[j],
+                                               angleRow ? angleRow + j*channels : nullptr);
+                    }
+                    continue;
+                }
 
-    std::vector<int> blue = NormalizedFreq(AcummulateFreq(Frequencies(img, 0)), totalOfPixels);
-    std::vector<int> green = NormalizedFreq(AcummulateFreq(Frequencies(img, 1)), totalOfPixels);
-    std::vector<int> red = NormalizedFreq(AcummulateFreq(Frequencies(img, 2)), totalOfPixels);
+                GradientBorderPixel<P>(src, i, 0, border, weight, l2, newRow[0], angleRow);
+                if (columns > 2) {
+                    GradientRow<T>(src.ptr<T>(i-1), src.ptr<T>(i), src.ptr<T>(i+1), channels, (columns-1)*channels,
+                                   channels, weight, l2, newImg.ptr<T>(i) + channels, angleRow ? angleRow + channels : nullptr);
+                }
+                GradientBorderPixel<P>(src, i, lastColumn, border, weight, l2, newRow[lastColumn],
+                                       angleRow ? angleRow + lastColumn*channels : nullptr);
+            }
+        });
+    });
 
+    // Alpha is not an edge, the shape keeps its coverage
+    CopyAlpha(src, newImg);
+}
+
+// Luma of img (interleaved) at full scale 1.0
+static void LumaPlane(const cv::Mat &img, cv::Mat &luma) {
+    const int rows=img.rows, columns=img.cols;
+    const double scale = 1 / DepthMax(img.depth());
+
+    luma.create(img.size(), CV_32F);
+    DispatchPixel(img.type(), [&](auto format) {
+        typedef decltype(format) P;
+        typedef typename P::Vec Pixel;
+
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+            for (int i=range.start;i<range.end;i++) {
+                LumaRow<P>(img.ptr<Pixel>(i), luma.ptr<float>(i), columns, scale);
+            }
+        });
+    });
+}
+
+#define CANNY_WEAK 1
+#define CANNY_STRONG 2
+
+void Canny(const cv::Mat &img, cv::OutputArray dst, double low, double high, int border) {
+    if (ThroughInterleaved(img, dst, [low, high, border](cv::Mat &packed) {Canny(packed, packed, low, high, border);})) {return;}
+
+    cv::Mat src = img;
+    const int rows=src.rows, columns=src.cols;
+    cv::Mat luma, magnitude, angle;
+    cv::Mat marks(rows, columns, CV_8U);
+    std::vector<cv::Point> stack;
+    int i, j, m, n;
+
+    // Sobel gradient of the luma, in float so the thresholds do not depend on the depth
+    LumaPlane(src, luma);
+    Gradient(luma, magnitude, 2, true, border, false, angle);
+
+    /* Non-maximum suppression: a pixel is kept when no neighbour across the edge is
+    stronger, the direction being rounded to one of 4 axes. Kept pixels are marked
+    weak or strong by the two thresholds. */
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+        for (int i=range.start;i<range.end;i++) {
+            const float *angleRow = angle.ptr<float>(i);
+            uchar *markRow = marks.ptr(i);
+            for (int j=0;j<columns;j++) {
+                float value = magnitude.ptr<float>(i)[j];
+                // Sector 0 is horizontal gradient (vertical edge), then 45, 90 and 135 degrees
+                int sector = int(std::floor((angleRow[j] + CV_PI/8) / (CV_PI/4))) & 3;
+                int di = sector == 0 ? 0 : 1;
+                int dj = sector == 2 ? 0 : (sector == 3 ? -1 : 1);
+                int ahead = cv::borderInterpolate(i+di, rows, cv::BORDER_REPLICATE);
+                int behind = cv::borderInterpolate(i-di, rows, cv::BORDER_REPLICATE);
+                float next = magnitude.ptr<float>(ahead)[cv::borderInterpolate(j+dj, columns, cv::BORDER_REPLICATE)];
+                float previous = magnitude.ptr<float>(behind)[cv::borderInterpolate(j-dj, columns, cv::BORDER_REPLICATE)];
+
+                if (value < low || value < next || value < previous) {
+                    markRow[j] = 0;
+                } else {
+                    markRow[j] = value >= high ? CANNY_STRONG : CANNY_WEAK;
+                }
+            }
+        }
+    });
+
+    // Hysteresis: weak pixels are kept only when connected to a strong one
     for (i=0;i<rows;i++) {
         for (j=0;j<columns;j++) {
-            oldPixel = img.at<cv::Vec3b>(i,j);
+            if (marks.ptr(i)[j] == CANNY_STRONG) {
+                stack.push_back(cv::Point(j, i));
+            }
+        }
+    }
+    while (!stack.empty()) {
+        cv::Point point = stack.back();
+        stack.pop_back();
+        for (m=std::max(point.y-1, 0);m<=std::min(point.y+1, rows-1);m++) {
+            for (n=std::max(point.x-1, 0);n<=std::min(point.x+1, columns-1);n++) {
+                if (marks.ptr(m)[n] == CANNY_WEAK) {
+                    marks.ptr(m)[n] = CANNY_STRONG;
+                    stack.push_back(cv::Point(n, m));
+                }
+            }
+        }
+    }
+
+    // White edges on black, in the type of img, alpha kept
+    cv::Mat newImg = CreateOutput(dst, src.size(), src.type(), src, false);
+    DispatchPixel(src.type(), [&](auto format) {
+        typedef decltype(format) P;
+        typedef typename P::Type T;
+        typedef typename P::Vec Pixel;
+        const T full = T(PixelMax<T>());
+
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+            for (int i=range.start;i<range.end;i++) {
+                const uchar *markRow = marks.ptr(i);
+                Pixel *newRow = newImg.ptr<Pixel>(i);
+                for (int j=0;j<columns;j++) {
+                    for (int k=0;k<P::Colours;k++) {
+                        newRow[j][k] = markRow[j] == CANNY_STRONG ? full : T(0);
+                    }
+                }
+            }
+        });
+    });
+    CopyAlpha(src, newImg);
+}
+
+// Boxes stacked for the Gaussian, three already follow the curve within a few percent
+#define GAUSSIAN_BOXES 3
+// Elements per column strip of the vertical box passes (4KB of floats)
+#define GAUSSIAN_STRIP 1024
 
-            newPixel[0] = blue[oldPixel[0]];
-            newPixel[1] = green[oldPixel[1]];
-            newPixel[2] = red[oldPixel[2]];
+/* Radii of GAUSSIAN_BOXES box filters whose variances add up to sigma^2 (Kovesi): the
+ideal width rounded down to odd for the first ones, two wider for the others. */
+static void BoxRadii(double sigma, int radii[GAUSSIAN_BOXES]) {
+    const int n = GAUSSIAN_BOXES;
+    const double variance = 12*sigma*sigma;
+    int lower = int(std::floor(std::sqrt(variance/n + 1)));
+    int wider, k;
 
-            newImg.at<cv::Vec3b>(i,j) = newPixel;
+    if (lower % 2 == 0) {lower--;}
+    wider = int(std::round((variance - n*lower*lower - 4*n*lower - 3*n) / (-4.0*lower - 4)));
+    for (k=0;k<n;k++) {
+        radii[k] = ((k < wider ? lower : lower+2) - 1) / 2;
+    }
+}
+
+int GaussianMargin(double sigma) {
+    int radii[GAUSSIAN_BOXES];
+    int margin = 0, k;
+
+    BoxRadii(sigma, radii);
+    for (k=0;k<GAUSSIAN_BOXES;k++) {
+        margin += radii[k];
+    }
+    return margin;
+}
+
+/* Box filter of an interleaved float row by running sums: one add and one subtract per
+element whatever the radius. padded holds (columns + 2 radius) * channels floats. */
+static void BoxRow(const float *in, float *out, float *padded, int columns, int channels, int radius, int border) {
+    const float inverse = 1.f / (2*radius + 1);
+    double sums[4];
+    int x, j, c, source;
+
+    for (x=-radius;x<columns+radius;x++) {
+        source = cv::borderInterpolate(x, columns, border);
+        for (c=0;c<channels;c++) {
+            padded[(x+radius)*channels + c] = source < 0 ? 0.f : in[source*channels + c];
         }
     }
 
-    return newImg;
+    for (c=0;c<channels;c++) {
+        sums[c] = 0;
+        for (x=0;x<2*radius+1;x++) {
+            sums[c] += padded[x*channels + c];
+        }
+        out[c] = float(sums[c] * inverse);
+    }
+    for (j=1;j<columns;j++) {
+        const float *entering = padded + (j+2*radius)*channels;
+        const float *leaving = padded + (j-1)*channels;
+        for (c=0;c<channels;c++) {
+            sums[c] += entering[c] - leaving[c];
+            out[j*channels + c] = float(sums[c] * inverse);
+        }
+    }
 }
 
-cv::Mat Lab(cv::Mat img) {
-    cv::Mat newImg = cv::Mat::zeros(img.size(), img.type());
-    cv::Mat labImg;
-    cv::cvtColor(img, labImg, cv::COLOR_BGR2Lab);
-    cv::Vec3b pixelBuffer;
-    int i, j;
-    int rows=img.rows, columns=img.cols;
-    int totalOfPixels = rows*columns;
+/* Vertical box filter of elements [from, to) of every row, from in to out: the running
+sums of a strip of columns move down together, one vector of columns at a time. */
+static void BoxColumns(const cv::Mat &in, cv::Mat &out, int from, int to, int radius, int border, const float *zeros) {
+    const int rows = in.rows;
+    const float inverse = 1.f / (2*radius + 1);
+    std::vector<float> sums(to - from, 0.f);
+    float *sum = sums.data() - from;
+    int i, y, e;
+
+    auto row = [&](int y) {
+        int source = cv::borderInterpolate(y, rows, border);
+        return source < 0 ? zeros : in.ptr<float>(source);
+    };
 
-    std::vector<int> frequencies = NormalizedFreq(AcummulateFreq(Frequencies(img, 0)), totalOfPixels);
+    for (y=-radius;y<=radius;y++) {
+        const float *values = row(y);
+        for (e=from;e<to;e++) {
+            sum[e] += values[e];
+        }
+    }
     for (i=0;i<rows;i++) {
-        for (j=0;j<columns;j++) {
-            pixelBuffer = labImg.at<cv::Vec3b>(i,j);
-            pixelBuffer[0] = frequencies[pixelBuffer[0]];
-            labImg.at<cv::Vec3b>(i,j) = pixelBuffer;
+        const float *entering = row(i+radius+1);
+        const float *leaving = row(i-radius);
+        float *outRow = out.ptr<float>(i);
+        e = from;
+#if CV_SIMD
+        const cv::v_float32 vInverse = cv::vx_setall_f32(inverse);
+        for (;e<=to-cv::v_float32::nlanes;e+=cv::v_float32::nlanes) {
+            cv::v_float32 running = cv::vx_load(sum + e);
+            cv::v_store(outRow + e, running * vInverse);
+            cv::v_store(sum + e, running + cv::vx_load(entering + e) - cv::vx_load(leaving + e));
+        }
+#endif
+        for (;e<to;e++) {
+            outRow[e] = sum[e] * inverse;
+            sum[e] += entering[e] - leaving[e];
         }
     }
+}
+
+void Gaussian(const cv::Mat &img, cv::OutputArray dst, double sigma, int border) {
+    auto gaussian = [sigma, border](cv::Mat &packed) {Gaussian(packed, packed, sigma, border);};
+    if (ImageChannels(img) == 4 && ThroughInterleaved(img, dst, gaussian)) {return;}
+    if (ForEachPlane(img, dst, ImageSize(img), true, false, [sigma, border](const cv::Mat &plane, cv::Mat &newPlane) {
+        Gaussian(plane, newPlane, sigma, border);
+    })) {return;}
+
+    CV_Assert(sigma > 0);
+    CV_Assert(border == cv::BORDER_REPLICATE || border == cv::BORDER_REFLECT_101 ||
+              border == cv::BORDER_WRAP || border == cv::BORDER_CONSTANT);
+    cv::Mat src = img;
+    const int rows=src.rows, columns=src.cols, channels=src.channels();
+    const int elements = columns*channels;
+    const int strips = (elements + GAUSSIAN_STRIP - 1) / GAUSSIAN_STRIP;
+    const double full = DepthMax(src.depth());
+    int radii[GAUSSIAN_BOXES];
+    int maxRadius = 0, k;
+    cv::Mat horizontal = PooledMat(rows, columns, CV_MAKETYPE(CV_32F, channels));
+    cv::Mat vertical = PooledMat(rows, columns, CV_MAKETYPE(CV_32F, channels));
+    std::vector<float> zeros(elements, 0.f);
+
+    BoxRadii(sigma, radii);
+    for (k=0;k<GAUSSIAN_BOXES;k++) {
+        maxRadius = std::max(maxRadius, radii[k]);
+    }
+
+    // Rows: widen to float (alpha premultiplied, like Convolution) and run every box, threaded over rows
+    DispatchPixel(src.type(), [&](auto format) {
+        typedef decltype(format) P;
+        typedef typename P::Vec Pixel;
+
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+            std::vector<float> line(elements), other(elements), padded((columns + 2*maxRadius)*channels);
+            for (int i=range.start;i<range.end;i++) {
+                const Pixel *row = src.ptr<Pixel>(i);
+                for (int j=0;j<columns;j++) {
+                    const float alpha = P::Channels == 4 ? float(row[j][P::Channels-1] / full) : 1.f;
+                    for (int c=0;c<P::Channels;c++) {
+                        line[j*channels + c] = c < P::Colours ? float(row[j][c]) * alpha : float(row[j][c]);
+                    }
+                }
+                for (int box=0;box<GAUSSIAN_BOXES;box++) {
+                    BoxRow(line.data(), other.data(), padded.data(), columns, channels, radii[box], border);
+                    line.swap(other);
+                }
+                std::copy(line.begin(), line.end(), horizontal.ptr<float>(i));
+            }
+        });
+    });
+
+    // Columns: strips are independent, and ping-pong between the two float images
+    cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range &range) {
+        for (int strip=range.start;strip<range.end;strip++) {
+            const int from = strip*GAUSSIAN_STRIP, to = std::min(from + GAUSSIAN_STRIP, elements);
+            for (int box=0;box<GAUSSIAN_BOXES;box++) {
+                if (box % 2 == 0) {
+                    BoxColumns(horizontal, vertical, from, to, radii[box], border, zeros.data());
+                } else {
+                    BoxColumns(vertical, horizontal, from, to, radii[box], border, zeros.data());
+                }
+            }
+        }
+    });
+    cv::Mat blurred = GAUSSIAN_BOXES % 2 ? vertical : horizontal;
+
+    // src is only read above, so dst may be img
+    cv::Mat newImg = CreateOutput(dst, src.size(), src.type(), src, true);
+    DispatchPixel(src.type(), [&](auto format) {
+        typedef decltype(format) P;
+        typedef typename P::Type T;
+        typedef typename P::Vec Pixel;
+        // Integer depths round instead of truncating
+        const double rounding = std::is_integral<T>::value ? 0.5 : 0;
 
-    cv::cvtColor(labImg, newImg, cv::COLOR_Lab2BGR);
-    return newImg;
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+            for (int i=range.start;i<range.end;i++) {
+                const float *row = blurred.ptr<float>(i);
+                Pixel *newRow = newImg.ptr<Pixel>(i);
+                for (int j=0;j<columns;j++) {
+                    const float *pixel = row + j*channels;
+                    const double alpha = P::Channels == 4 ? pixel[P::Channels-1] / full : 1;
+                    for (int c=0;c<P::Channels;c++) {
+                        double value = pixel[c];
+                        if (c < P::Colours && P::Channels == 4) {
+                            value = alpha > 0 ? value / alpha : 0;
+                        }
+                        newRow[j][c] = ClampPixel<T>(value + rounding);
+                    }
+                }
+            }
+        });
+    });
 }
 
+// Stripes are at least this many vertical windows tall, so their warm-up rows stay a small share
+#define UNSHARP_STRIPE_WINDOWS 4
 
-// corrigir shadeFound para bool
-cv::Mat Quantization(cv::Mat img, int numShades) {
-    cv::Mat newImg = cv::Mat::zeros(img.size(), img.type());
-    cv::Vec3b pixelBuffer;
-    uchar lumBuffer;
-    int i, j, shadeFound;
-    int rows=img.rows, columns=img.cols;
-    int minShade=255, maxShade=0;
-    float tBin, base;
+int UnsharpMargin(double sigma) {
+    // The same stacked boxes as Gaussian, in both directions
+    return GaussianMargin(sigma);
+}
 
-    for (i=0;i<rows;i++) {
-        for (j=0;j<columns;j++) {
-            lumBuffer = img.at<cv::Vec3b>(i,j)[0];
-            if (lumBuffer < minShade) {
-                minShade = lumBuffer;
-            } else if (lumBuffer > maxShade) {
-                maxShade = lumBuffer;
+/* Sharpens by adding back amount times the difference between the luma and its Gaussian
+blur, wherever that difference reaches threshold. Adding the same luma detail to every
+colour keeps hues. The blur is the stacked running-sum boxes of Gaussian both ways, so
+it is isotropic and costs the same per pixel whatever sigma. Each stripe of rows streams:
+the luma of every row is blurred horizontally into the ring of the first box, and each box
+moves a running sum of columns down its ring, handing its rows to the next box. Rows
+leaving the last box are compared and written at once, so no full-frame buffer is made.
+Vertically the boxes read the border of the source rows rather than of their own input. */
+void UnsharpMask(const cv::Mat &img, cv::OutputArray dst, double amount, double sigma, double threshold, int border) {
+    if (ThroughInterleaved(img, dst, [amount, sigma, threshold, border](cv::Mat &packed) {
+        UnsharpMask(packed, packed, amount, sigma, threshold, border);
+    })) {return;}
+
+    CV_Assert(sigma > 0);
+    CV_Assert(border == cv::BORDER_REPLICATE || border == cv::BORDER_REFLECT_101 ||
+              border == cv::BORDER_WRAP || border == cv::BORDER_CONSTANT);
+    cv::Mat src = img;
+    // Output rows are written while other stripes still read their neighbours
+    cv::Mat newImg = CreateOutput(dst, src.size(), src.type(), src, false);
+    const int rows=src.rows, columns=src.cols;
+    const int margin = UnsharpMargin(sigma);
+    const int stripes = std::min(RowStripes(rows), std::max(1, rows / (UNSHARP_STRIPE_WINDOWS*(2*margin + 1))));
+    const double full = DepthMax(src.depth()), scale = 1 / full;
+    int boxes[GAUSSIAN_BOXES], widest = 0;
+    int k;
+
+    BoxRadii(sigma, boxes);
+    for (k=0;k<GAUSSIAN_BOXES;k++) {
+        widest = std::max(widest, boxes[k]);
+    }
+
+    DispatchPixel(src.type(), [&](auto format) {
+        typedef decltype(format) P;
+        typedef typename P::Type T;
+        typedef typename P::Vec Pixel;
+        const double rounding = std::is_integral<T>::value ? 0.5 : 0;
+
+        cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range) {
+            // Box b keeps its input rows in a ring of 2 radius + 2, the last one being the row leaving it
+            std::vector<float> rings[GAUSSIAN_BOXES], sums[GAUSSIAN_BOXES];
+            std::vector<float> padded(columns + 2*widest), luma(columns), blurred(columns), zeros(columns, 0.f);
+            int first[GAUSSIAN_BOXES];
+
+            for (int b=0;b<GAUSSIAN_BOXES;b++) {
+                rings[b].resize((2*boxes[b] + 2) * columns);
+                sums[b].resize(columns);
+            }
+            auto ringRow = [&](int b, int y) {
+                const int size = 2*boxes[b] + 2;
+                return &rings[b][(((y % size) + size) % size) * columns];
+            };
+
+            // Output row i: the luma detail above the blur, added to every colour
+            auto writeRow = [&](int i) {
+                const Pixel *row = src.ptr<Pixel>(i);
+                Pixel *newRow = newImg.ptr<Pixel>(i);
+                LumaRow<P>(row, luma.data(), columns, scale);
+                for (int j=0;j<columns;j++) {
+                    const double detail = luma[j] - blurred[j];
+                    if (std::abs(detail) < threshold) {
+                        newRow[j] = row[j];
+                        continue;
+                    }
+                    for (int c=0;c<P::Colours;c++) {
+                        newRow[j][c] = ClampPixel<T>(row[j][c] + amount * detail * full + rounding);
+                    }
+                    if constexpr (P::Channels == 4) {
+                        newRow[j][3] = row[j][3];
+                    }
+                }
+            };
+
+            // Row y has entered the ring of box b: its sum moves down, and full windows go on
+            auto push = [&](int b, int y) {
+                while (true) {
+                    const int radius = boxes[b];
+                    const float inverse = 1.f / (2*radius + 1);
+                    const float *entering = ringRow(b, y);
+                    const float *leaving = y - first[b] > 2*radius ? ringRow(b, y - 2*radius - 1) : zeros.data();
+                    const bool ready = y - first[b] >= 2*radius;
+                    float *sum = sums[b].data();
+                    float *out = b+1 < GAUSSIAN_BOXES ? ringRow(b+1, y - radius) : blurred.data();
+                    int j = 0;
+#if CV_SIMD
+                    const cv::v_float32 vInverse = cv::vx_setall_f32(inverse);
+                    for (;j<=columns-cv::v_float32::nlanes;j+=cv::v_float32::nlanes) {
+                        cv::v_float32 running = cv::vx_load(sum + j) + cv::vx_load(entering + j) - cv::vx_load(leaving + j);
+                        cv::v_store(sum + j, running);
+                        if (ready) {
+                            cv::v_store(out + j, running * vInverse);
+                        }
+                    }
+#endif
+                    for (;j<columns;j++) {
+                        sum[j] += entering[j] - leaving[j];
+                        if (ready) {
+                            out[j] = sum[j] * inverse;
+                        }
+                    }
+                    if (!ready) {return;}
+                    if (b+1 == GAUSSIAN_BOXES) {
+                        writeRow(y - radius);
+                        return;
+                    }
+                    y -= radius;
+                    b++;
+                }
+            };
+
+            for (int stripe=range.start;stripe<range.end;stripe++) {
+                cv::Range stripeRows = StripeRows(stripe, stripes, rows);
+                first[0] = stripeRows.start - margin;
+                for (int b=0;b<GAUSSIAN_BOXES;b++) {
+                    if (b > 0) {
+                        first[b] = first[b-1] + boxes[b-1];
+                    }
+                    std::fill(sums[b].begin(), sums[b].end(), 0.f);
+                }
+                // Horizontal blur of the luma of every row the stripe reads, into the first ring
+                for (int y=first[0];y<stripeRows.end+margin;y++) {
+                    float *slot = ringRow(0, y);
+                    int source = cv::borderInterpolate(y, rows, border);
+                    if (source < 0) {
+                        std::fill(slot, slot + columns, 0.f);
+                    } else {
+                        LumaRow<P>(src.ptr<Pixel>(source), luma.data(), columns, scale);
+                        // BoxRow pads its input before writing, so the later boxes run in place on the slot
+                        BoxRow(luma.data(), slot, padded.data(), columns, 1, boxes[0], border);
+                        for (int b=1;b<GAUSSIAN_BOXES;b++) {
+                            BoxRow(slot, slot, padded.data(), columns, 1, boxes[b], border);
+                        }
+                    }
+                    push(0, y);
+                }
             }
+        });
+    });
+}
+
+// Radii up to this use a sorting network, larger ones the histogram median
+#define MEDIAN_NETWORK_RADIUS 2
+#define MEDIAN_NETWORK_SIZE ((2*MEDIAN_NETWORK_RADIUS + 1) * (2*MEDIAN_NETWORK_RADIUS + 1))
+// Columns per tile of the histogram median, which keeps its column histograms in cache
+#define MEDIAN_TILE_COLUMNS 256
+
+/* Comparators of Knuth's merge exchange sort of n values, keeping only those the
+middle value depends on. */
+static std::vector<std::pair<int, int>> MedianNetwork(int n) {
+    std::vector<std::pair<int, int>> comparators, kept;
+    std::vector<bool> needed(n, false);
+    int t = 0, p, q, r, d, i, k;
+
+    while ((1 << t) < n) {t++;}
+    for (p=t > 0 ? 1 << (t-1) : 0;p>0;p>>=1) {
+        q = 1 << (t-1);
+        r = 0;
+        d = p;
+        while (true) {
+            for (i=0;i<n-d;i++) {
+                if ((i & p) == r) {
+                    comparators.push_back(std::make_pair(i, i+d));
+                }
+            }
+            if (q == p) {break;}
+            d = q - p;
+            q >>= 1;
+            r = p;
         }
     }
 
-    if (numShades >= maxShade-minShade+1) {
-        return img;
+    needed[n/2] = true;
+    for (k=int(comparators.size())-1;k>=0;k--) {
+        if (needed[comparators[k].first] || needed[comparators[k].second]) {
+            needed[comparators[k].first] = true;
+            needed[comparators[k].second] = true;
+            kept.push_back(comparators[k]);
+        }
+    }
+    std::reverse(kept.begin(), kept.end());
+    return kept;
+}
+
+static const std::vector<std::pair<int, int>> &MedianNetworkFor(int radius) {
+    static const std::vector<std::pair<int, int>> networks[MEDIAN_NETWORK_RADIUS+1] = {
+        MedianNetwork(1), MedianNetwork(9), MedianNetwork(25)
+    };
+    return networks[radius];
+}
+
+// Same compare-exchange for samples and for SIMD lanes
+template <typename V>
+static void SortPair(V &a, V &b) {
+    V low;
+
+    if constexpr (std::is_arithmetic<V>::value) {
+        low = std::min(a, b);
+        b = std::max(a, b);
     } else {
-        tBin = ((float)maxShade-(float)minShade+1.0)/numShades;
-        for (i=0;i<rows;i++) {
-            for (j=0;j<columns;j++) {
-                lumBuffer = img.at<cv::Vec3b>(i,j)[0];
-                base = minShade-0.5+tBin;
-                shadeFound = 0;
-                while (base < 255 && shadeFound == 0) {
-                    if (lumBuffer < base) {
-                        base -= tBin/2;
-                        lumBuffer = (int)base;
-                        shadeFound = 1;
-                    } else {
-                        base += tBin;
+        low = cv::v_min(a, b);
+        b = cv::v_max(a, b);
+    }
+    a = low;
+}
+
+/* Median of the (2 radius + 1)^2 window around elements [from, to) of the middle row,
+window holding the row pointers and step being the distance between pixels, written
+to out[e - from]. Every lane of a vector runs the same network, so the interior of
+all depths is SIMD. */
+template <typename T>
+static void MedianRow(const T *const *window, int from, int to, int step, int radius,
+                      const std::vector<std::pair<int, int>> &network, T *out) {
+    const int side = 2*radius + 1, size = side*side;
+    T values[MEDIAN_NETWORK_SIZE];
+    int e = from, m, n;
+
+#if CV_SIMD
+    typedef decltype(cv::vx_load(window[0])) V;
+    V lanes[MEDIAN_NETWORK_SIZE];
+    for (;e<=to-V::nlanes;e+=V::nlanes) {
+        for (m=0;m<side;m++) {
+            for (n=0;n<side;n++) {
+                lanes[m*side + n] = cv::vx_load(window[m] + e + (n-radius)*step);
+            }
+        }
+        for (const std::pair<int, int> &comparator : network) {
+            SortPair(lanes[comparator.first], lanes[comparator.second]);
+        }
+        cv::v_store(out + e - from, lanes[size/2]);
+    }
+#endif
+    for (;e<to;e++) {
+        for (m=0;m<side;m++) {
+            for (n=0;n<side;n++) {
+                values[m*side + n] = window[m][e + (n-radius)*step];
+            }
+        }
+        for (const std::pair<int, int> &comparator : network) {
+            SortPair(values[comparator.first], values[comparator.second]);
+        }
+        out[e-from] = values[size/2];
+    }
+}
+
+// Border pixel (i, j), its window gathered through cv::borderInterpolate like ConvolveBorderPixel
+template <typename P>
+static void MedianBorderPixel(const cv::Mat &src, int i, int j, int border, int radius,
+                              const std::vector<std::pair<int, int>> &network, typename P::Vec &out) {
+    typedef typename P::Type T;
+    typedef typename P::Vec Pixel;
+    const int side = 2*radius + 1;
+    T values[MEDIAN_NETWORK_SIZE];
+    int rowIndices[2*MEDIAN_NETWORK_RADIUS + 1], columnIndices[2*MEDIAN_NETWORK_RADIUS + 1];
+    int k, m, n;
+
+    for (m=0;m<side;m++) {
+        rowIndices[m] = cv::borderInterpolate(i-radius+m, src.rows, border);
+        columnIndices[m] = cv::borderInterpolate(j-radius+m, src.cols, border);
+    }
+    for (k=0;k<P::Channels;k++) {
+        for (m=0;m<side;m++) {
+            for (n=0;n<side;n++) {
+                values[m*side + n] = rowIndices[m] < 0 || columnIndices[n] < 0 ? T(0) :
+                                     src.ptr<Pixel>(rowIndices[m])[columnIndices[n]][k];
+            }
+        }
+        for (const std::pair<int, int> &comparator : network) {
+            SortPair(values[comparator.first], values[comparator.second]);
+        }
+        out[k] = values[side*side/2];
+    }
+}
+
+static void NetworkMedian(const cv::Mat &src, cv::Mat &newImg, int radius, int border) {
+    const std::vector<std::pair<int, int>> &network = MedianNetworkFor(radius);
+    const int rows=src.rows, columns=src.cols, channels=src.channels();
+
+    DispatchPixel(src.type(), [&](auto format) {
+        typedef decltype(format) P;
+        typedef typename P::Type T;
+        typedef typename P::Vec Pixel;
+
+        // Interior rows and columns read their window unchecked, as in Convolution
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+            for (int i=range.start;i<range.end;i++) {
+                Pixel *newRow = newImg.ptr<Pixel>(i);
+                int interiorEnd = std::max(columns-radius, radius);
+                if (i < radius || i >= rows-radius) {
+                    interiorEnd = radius;
+                }
+
+                for (int j=0;j<std::min(radius, columns);j++) {
+                    MedianBorderPixel<P>(src, i, j, border, radius, network, newRow[j]);
+                }
+                if (interiorEnd > radius) {
+                    const T *window[2*MEDIAN_NETWORK_RADIUS + 1];
+                    for (int m=0;m<2*radius+1;m++) {
+                        window[m] = src.ptr<T>(i-radius+m);
+                    }
+                    MedianRow<T>(window, radius*channels, interiorEnd*channels, channels, radius, network,
+                                 newImg.ptr<T>(i) + radius*channels);
+                }
+                for (int j=std::max(interiorEnd, std::min(radius, columns));j<columns;j++) {
+                    MedianBorderPixel<P>(src, i, j, border, radius, network, newRow[j]);
+                }
+            }
+        });
+    });
+}
+
+/* Constant-time median (Perreault and Hebert) of an 8-bit image: every column keeps the
+histogram of its 2 radius + 1 window rows, updated by one row in and one out per image
+row, and the window histogram slides along the row by adding one column histogram and
+removing another. Cost per pixel does not depend on the radius. Tiles of rows and
+columns are independent, which keeps the column histograms small and runs them in
+parallel. */
+static void HistogramMedian(const cv::Mat &src, cv::Mat &newImg, int radius, int border) {
+    const int rows=src.rows, columns=src.cols, channels=src.channels();
+    const int side = 2*radius + 1, half = side*side/2;
+    const int stripes = RowStripes(rows);
+    const int columnTiles = (columns + MEDIAN_TILE_COLUMNS - 1) / MEDIAN_TILE_COLUMNS;
+
+    cv::parallel_for_(cv::Range(0, stripes*columnTiles), [&](const cv::Range &range) {
+        for (int tile=range.start;tile<range.end;tile++) {
+            cv::Range tileRows = StripeRows(tile / columnTiles, stripes, rows);
+            const int first = (tile % columnTiles) * MEDIAN_TILE_COLUMNS;
+            const int last = std::min(first + MEDIAN_TILE_COLUMNS, columns);
+            // Histograms of columns first - radius to last + radius, each channel apart
+            const int width = last - first + 2*radius;
+            std::vector<ushort> columnCounts(width*channels*256, 0);
+            std::vector<int> sourceColumns(width);
+            std::vector<int> counts(channels*256);
+
+            for (int x=0;x<width;x++) {
+                sourceColumns[x] = cv::borderInterpolate(first-radius+x, columns, border);
+            }
+            auto countRow = [&](int y, int delta) {
+                int row = cv::borderInterpolate(y, rows, border);
+                const uchar *pixels = row < 0 ? nullptr : src.ptr(row);
+                for (int x=0;x<width;x++) {
+                    for (int c=0;c<channels;c++) {
+                        uchar value = pixels && sourceColumns[x] >= 0 ? pixels[sourceColumns[x]*channels + c] : 0;
+                        columnCounts[(x*channels + c)*256 + value] += delta;
+                    }
+                }
+            };
+
+            for (int y=tileRows.start-radius;y<=tileRows.start+radius;y++) {
+                countRow(y, 1);
+            }
+            for (int i=tileRows.start;i<tileRows.end;i++) {
+                uchar *newRow = newImg.ptr(i);
+                if (i > tileRows.start) {
+                    countRow(i-radius-1, -1);
+                    countRow(i+radius, 1);
+                }
+
+                // Window of the first pixel, then one column in and one out per pixel
+                std::fill(counts.begin(), counts.end(), 0);
+                for (int x=0;x<side;x++) {
+                    const ushort *column = &columnCounts[x*channels*256];
+                    for (int v=0;v<channels*256;v++) {
+                        counts[v] += column[v];
+                    }
+                }
+                for (int j=first;j<last;j++) {
+                    if (j > first) {
+                        const ushort *in = &columnCounts[(j-first+2*radius)*channels*256];
+                        const ushort *out = &columnCounts[(j-first-1)*channels*256];
+                        for (int v=0;v<channels*256;v++) {
+                            counts[v] += int(in[v]) - int(out[v]);
+                        }
+                    }
+                    for (int c=0;c<channels;c++) {
+                        const int *channelCounts = &counts[c*256];
+                        int accumulated = 0, value = 0;
+                        while (accumulated + channelCounts[value] <= half) {
+                            accumulated += channelCounts[value];
+                            value++;
+                        }
+                        newRow[j*channels + c] = uchar(value);
+                    }
+                }
+            }
+        }
+    });
+}
+
+void Median(const cv::Mat &img, cv::OutputArray dst, int radius, int border) {
+    if (ForEachPlane(img, dst, ImageSize(img), false, false, [radius, border](const cv::Mat &plane, cv::Mat &newPlane) {
+        Median(plane, newPlane, radius, border);
+    })) {return;}
+    if (radius > MEDIAN_NETWORK_RADIUS && Through8Bit(img, dst, [radius, border](cv::Mat &narrow) {
+        Median(narrow, narrow, radius, border);
+    })) {return;}
+
+    CV_Assert(radius >= 1);
+    CV_Assert(border == cv::BORDER_REPLICATE || border == cv::BORDER_REFLECT_101 ||
+              border == cv::BORDER_WRAP || border == cv::BORDER_CONSTANT);
+    cv::Mat src = img;
+    cv::Mat newImg = CreateOutput(dst, src.size(), src.type(), src, false);
+
+    if (radius > MEDIAN_NETWORK_RADIUS) {
+        HistogramMedian(src, newImg, radius, border);
+    } else {
+        NetworkMedian(src, newImg, radius, border);
+    }
+}
+
+/* Bilateral grid (Paris and Durand): colours are summed into a coarse 3-D grid of
+position (one cell per spatial pixels) and luma (one cell per range), the grid is
+blurred with [1 2 1] along its three axes, and every pixel reads its colour back by
+trilinear interpolation. The cost is a few passes over the image whatever the sigmas.
+Grid rows are splatted by disjoint bands of image rows, so every pass is threaded. */
+void Bilateral(const cv::Mat &img, cv::OutputArray dst, int spatial, double range) {
+    if (ThroughInterleaved(img, dst, [spatial, range](cv::Mat &packed) {Bilateral(packed, packed, spatial, range);})) {return;}
+
+    CV_Assert(spatial >= 1 && range > 0);
+    cv::Mat src = img;
+    cv::Mat luma;
+    const int rows=src.rows, columns=src.cols, colours=std::min(src.channels(), 3);
+    const int gridRows = (rows + spatial/2)/spatial + 3,
+              gridColumns = (columns + spatial/2)/spatial + 3,
+              levels = int(1/range + 0.5) + 3;
+    // Colour sums plus the number of pixels in each cell
+    const int cellSize = colours + 1;
+    std::vector<float> grid(size_t(gridRows)*gridColumns*levels*cellSize, 0.f), blurred(grid.size());
+    const double scale = 1 / DepthMax(src.depth());
+
+    auto cell = [&](int y, int x, int z) {
+        return ((size_t(y)*gridColumns + x)*levels + z)*cellSize;
+    };
+    auto level = [range](float value) {
+        return std::min(std::max(double(value), 0.0), 1.0) / range + 1;
+    };
+
+    LumaPlane(src, luma);
+
+    DispatchPixel(src.type(), [&](auto format) {
+        typedef decltype(format) P;
+        typedef typename P::Type T;
+        typedef typename P::Vec Pixel;
+
+        // Splat: grid row y takes image rows (y-1) spatial -+ spatial/2, which no other grid row takes
+        cv::parallel_for_(cv::Range(1, gridRows-1), [&](const cv::Range &gridRange) {
+            for (int y=gridRange.start;y<gridRange.end;y++) {
+                int firstRow = std::max((y-1)*spatial - spatial/2, 0), lastRow = std::min(y*spatial - spatial/2, rows);
+                for (int i=firstRow;i<lastRow;i++) {
+                    const Pixel *row = src.ptr<Pixel>(i);
+                    const float *lumaRow = luma.ptr<float>(i);
+                    for (int j=0;j<columns;j++) {
+                        float *sums = &grid[cell(y, (j + spatial/2)/spatial + 1, int(level(lumaRow[j]) + 0.5))];
+                        for (int k=0;k<colours;k++) {
+                            sums[k] += float(row[j][k] * scale);
+                        }
+                        sums[colours] += 1;
                     }
                 }
-                if (shadeFound == 0) {lumBuffer = (int)(base-tBin/2.0);}
+            }
+        });
+
+        // Blur one axis at a time, threaded over grid rows
+        auto blur = [&](int dy, int dx, int dz) {
+            cv::parallel_for_(cv::Range(0, gridRows), [&](const cv::Range &gridRange) {
+                for (int y=gridRange.start;y<gridRange.end;y++) {
+                    for (int x=0;x<gridColumns;x++) {
+                        for (int z=0;z<levels;z++) {
+                            const float *centre = &grid[cell(y, x, z)];
+                            const bool before = y-dy >= 0 && x-dx >= 0 && z-dz >= 0;
+                            const bool after = y+dy < gridRows && x+dx < gridColumns && z+dz < levels;
+                            const float *previous = before ? &grid[cell(y-dy, x-dx, z-dz)] : nullptr;
+                            const float *next = after ? &grid[cell(y+dy, x+dx, z+dz)] : nullptr;
+                            float *out = &blurred[cell(y, x, z)];
+                            for (int k=0;k<cellSize;k++) {
+                                out[k] = 0.5f*centre[k] + (previous ? 0.25f*previous[k] : 0.f) + (next ? 0.25f*next[k] : 0.f);
+                            }
+                        }
+                    }
+                }
+            });
+            grid.swap(blurred);
+        };
+        blur(0, 0, 1);
+        blur(0, 1, 0);
+        blur(1, 0, 0);
 
-                pixelBuffer[0] = lumBuffer;
-                pixelBuffer[1] = pixelBuffer[0];
-                pixelBuffer[2] = pixelBuffer[1];
-                newImg.at<cv::Vec3b>(i,j) = pixelBuffer;
+        // Slice
+        cv::Mat newImg = CreateOutput(dst, src.size(), src.type(), src, false);
+        const double full = DepthMax(src.depth());
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &rowRange) {
+            for (int i=rowRange.start;i<rowRange.end;i++) {
+                const Pixel *row = src.ptr<Pixel>(i);
+                const float *lumaRow = luma.ptr<float>(i);
+                Pixel *newRow = newImg.ptr<Pixel>(i);
+                const double fy = double(i)/spatial + 1;
+                const int y0 = int(fy);
+                const double wy = fy - y0;
+                for (int j=0;j<columns;j++) {
+                    const double fx = double(j)/spatial + 1, fz = level(lumaRow[j]);
+                    const int x0 = int(fx), z0 = int(fz);
+                    const double wx = fx - x0, wz = fz - z0;
+                    double sums[4] = {0, 0, 0, 0};
+                    for (int corner=0;corner<8;corner++) {
+                        const int cy = corner >> 2, cx = (corner >> 1) & 1, cz = corner & 1;
+                        const double weight = (cy ? wy : 1-wy) * (cx ? wx : 1-wx) * (cz ? wz : 1-wz);
+                        const float *values = &grid[cell(y0+cy, x0+cx, z0+cz)];
+                        for (int k=0;k<cellSize;k++) {
+                            sums[k] += weight * values[k];
+                        }
+                    }
+                    for (int k=0;k<colours;k++) {
+                        newRow[j][k] = sums[colours] > 0 ? ClampPixel<T>(sums[k] / sums[colours] * full) : row[j][k];
+                    }
+                }
             }
+        });
+        // Alpha is kept as it was
+        CopyAlpha(src, newImg);
+    });
+}
+
+cv::Mat ReadImage(const std::string &path) {
+    std::string extension = fs::path(path).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    // Formats that can carry alpha are read unchanged, which skips the EXIF orientation of JPEGs
+    bool alpha = extension == ".png" || extension == ".webp" || extension == ".tif" || extension == ".tiff";
+    cv::Mat img = cv::imread(path, alpha ? cv::IMREAD_UNCHANGED : cv::IMREAD_COLOR | cv::IMREAD_ANYDEPTH);
+    int depth = img.depth();
+
+    if (img.empty()) {return img;}
+    // Other depths become float, their own full range mapped to 0..1 (double and half floats already are)
+    if (depth == CV_8S) {
+        img.convertTo(img, CV_32F, 1.0 / 255, 128.0 / 255);
+    } else if (depth == CV_16S) {
+        img.convertTo(img, CV_32F, 1.0 / 65535, 32768.0 / 65535);
+    } else if (depth == CV_32S) {
+        img.convertTo(img, CV_32F, 1.0 / 4294967295.0, 2147483648.0 / 4294967295.0);
+    } else if (depth != CV_8U && depth != CV_16U && depth != CV_32F) {
+        img.convertTo(img, CV_32F);
+    }
+
+    // The kernels take BGR or BGRA
+    if (img.channels() == 1) {
+        cv::cvtColor(img, img, cv::COLOR_GRAY2BGR);
+    } else if (img.channels() == 2) {
+        cv::Mat withAlpha(img.size(), CV_MAKETYPE(img.depth(), 4));
+        const int fromTo[] = {0,0, 0,1, 0,2, 1,3};
+        cv::mixChannels(&img, 1, &withAlpha, 1, fromTo, 4);
+        img = withAlpha;
+    }
+    return img;
+}
+
+void ConvertDepth(const cv::Mat &img, cv::OutputArray dst, int depth) {
+    int type = CV_MAKETYPE(depth, img.channels());
+
+    if (img.depth() == depth) {
+        cv::Mat newImg = CreateOutputLike(dst, img, type, true);
+        if (newImg.data != img.data) {
+            img.copyTo(newImg);
         }
+        return;
     }
 
-    return newImg;
+    // convertTo is vectorized and threaded, and rounds and saturates into integer depths
+    cv::Mat newImg = CreateOutputLike(dst, img, type, false);
+    img.convertTo(newImg, depth, DepthMax(depth) / DepthMax(img.depth()));
 }
 
-cv::Mat Brightness(cv::Mat img, int bias) {
-    cv::Mat newImg = cv::Mat::zeros(img.size(), img.type());
-    cv::Vec3b pixelBuffer;
-    int colorBuffer;
-    int i, j, k;
+cv::Mat DisplayDepth(const cv::Mat &img) {
+    cv::Mat packed, narrow;
+
+    if (img.empty()) {return img;}
+    packed = img;
+    if (IsPlanar(img)) {
+        ToInterleaved(img, packed);
+    }
+    if (packed.depth() == CV_8U) {return packed;}
+    ConvertDepth(packed, narrow, CV_8U);
+    return narrow;
+}
+
+cv::Mat EncoderDepth(const cv::Mat &img) {
+    cv::Mat packed, narrow;
+
+    if (img.empty()) {return img;}
+    packed = img;
+    if (IsPlanar(img)) {
+        ToInterleaved(img, packed);
+    }
+    if (packed.depth() != CV_32F) {return packed;}
+    ConvertDepth(packed, narrow, CV_16U);
+    return narrow;
+}
+
+void Equalization(const cv::Mat &img, cv::OutputArray dst) {
+    std::vector<std::vector<int>> frequencies;
+    const int channels = img.channels();
+    cv::Mat lut(1, 256, CV_8UC(channels));
+    uchar table[256];
+    int k, value;
+
+    // Every plane is equalized on its own table, alpha is kept
+    if (ForEachPlane(img, dst, ImageSize(img), true, true, Equalization)) {return;}
+    if (Through8Bit(img, dst, [](cv::Mat &narrow) {Equalization(narrow, narrow);})) {return;}
+
+    // Tables are built before the output is touched, so dst may be img
+    ChannelFrequencies(img, frequencies);
+    for (k=0;k<channels;k++) {
+        EqualizationLUT(frequencies[k], img.rows*img.cols, table);
+        for (value=0;value<256;value++) {
+            // Alpha goes through unchanged
+            lut.ptr()[value*channels + k] = k == 3 ? uchar(value) : table[value];
+        }
+    }
+
+    // cv::LUT remaps every channel through its own table, vectorized and threaded
+    cv::Mat newImg = CreateOutput(dst, img.size(), img.type(), img, true);
+    cv::LUT(img, lut, newImg);
+}
+
+/* Calls function(rows, labChunk) for consecutive chunks of rows of a BGR(A) image, each
+converted to L*a*b* in a small per-thread buffer that stays in cache. */
+template <typename Function>
+static void ForEachLabChunk(const cv::Mat &img, Function function) {
     const int rows=img.rows, columns=img.cols;
+    const int chunkRows = std::max(1, LAB_CHUNK_PIXELS / std::max(columns, 1));
+    const int chunks = (rows + chunkRows - 1) / chunkRows;
 
-    for (i=0;i<rows;i++) {
-        for (j=0;j<columns;j++) {
-            pixelBuffer = img.at<cv::Vec3b>(i,j);
-            for (k=0;k<3;k++) {
-                colorBuffer = pixelBuffer[k] + bias;
-                if (colorBuffer > 255) {
-                    colorBuffer = 255;
-                } else if (colorBuffer<0) {
-                    colorBuffer = 0;
+    cv::parallel_for_(cv::Range(0, chunks), [&](const cv::Range &range) {
+        cv::Mat labBuffer = PooledMat(chunkRows, columns, CV_8UC3);
+        for (int chunk=range.start;chunk<range.end;chunk++) {
+            cv::Range chunkRange(chunk*chunkRows, std::min(rows, (chunk+1)*chunkRows));
+            cv::Mat labChunk = labBuffer.rowRange(0, chunkRange.size());
+            cv::cvtColor(img.rowRange(chunkRange), labChunk, cv::COLOR_BGR2Lab);
+            function(chunkRange, labChunk);
+        }
+    });
+}
+
+/* Writes a L*a*b* image back into the colour channels of out. A fourth channel of
+out takes the alpha of alphaSource, which may be out itself. */
+static void LabToColours(const cv::Mat &lab, const cv::Mat &alphaSource, cv::Mat out) {
+    if (out.channels() == 3) {
+        cv::cvtColor(lab, out, cv::COLOR_Lab2BGR);
+        return;
+    }
+
+    cv::Mat colours = PooledMat(lab.size(), CV_8UC3);
+    const cv::Mat sources[2] = {colours, alphaSource};
+    const int fromTo[] = {0,0, 1,1, 2,2, 6,3};
+    cv::cvtColor(lab, colours, cv::COLOR_Lab2BGR);
+    cv::mixChannels(sources, 2, &out, 1, fromTo, 4);
+}
+
+// Luminance equalization without full-frame L*a*b* copies: one pass for the L* histogram, one to remap
+void Lab(const cv::Mat &img, cv::OutputArray dst) {
+    std::vector<int> frequencies(256, 0);
+    std::mutex frequenciesLock;
+    uchar table[256];
+
+    if (ThroughInterleaved(img, dst, [](cv::Mat &packed) {Lab(packed, packed);})) {return;}
+    if (Through8Bit(img, dst, [](cv::Mat &narrow) {Lab(narrow, narrow);})) {return;}
+    // A single channel already is the luminance
+    if (img.channels() == 1) {
+        Equalization(img, dst);
+        return;
+    }
+
+    ForEachLabChunk(img, [&](const cv::Range &, const cv::Mat &labChunk) {
+        int counts[256] = {0};
+        for (int i=0;i<labChunk.rows;i++) {
+            const cv::Vec3b *row = labChunk.ptr<cv::Vec3b>(i);
+            for (int j=0;j<labChunk.cols;j++) {
+                counts[row[j][0]]++;
+            }
+        }
+        std::lock_guard<std::mutex> guard(frequenciesLock);
+        for (int v=0;v<256;v++) {
+            frequencies[v] += counts[v];
+        }
+    });
+    EqualizationLUT(frequencies, img.rows*img.cols, table);
+
+    // Rows are converted before they are written back, so dst may be img
+    cv::Mat newImg = CreateOutput(dst, img.size(), img.type(), img, true);
+    ForEachLabChunk(img, [&](const cv::Range &chunkRange, cv::Mat &labChunk) {
+        for (int i=0;i<labChunk.rows;i++) {
+            cv::Vec3b *row = labChunk.ptr<cv::Vec3b>(i);
+            for (int j=0;j<labChunk.cols;j++) {
+                row[j][0] = table[row[j][0]];
+            }
+        }
+        LabToColours(labChunk, img.rowRange(chunkRange), newImg.rowRange(chunkRange));
+    });
+}
+
+/* Contrast-limited adaptive equalization of one channel. Each tile gets its own clipped
+table and every pixel blends the tables of the four nearest tile centres. When
+broadcast is set the result goes to every colour channel of out, otherwise only to channel. */
+static void AdaptiveChannel(const cv::Mat &src, int channel, cv::Mat &out, bool broadcast,
+                            cv::Size tiles, double clipLimit) {
+    const int rows=src.rows, columns=src.cols;
+    const int srcChannels=src.channels(), outChannels=out.channels();
+    const int outColours = std::min(outChannels, 3);
+    std::vector<std::vector<int>> frequencies;
+    std::vector<uchar> tables(tiles.area()*256);
+    std::vector<int> leftTile(columns), rightTile(columns);
+    std::vector<float> rightWeight(columns);
+    const float tileHeight = static_cast<float>(rows)/tiles.height;
+    const float tileWidth = static_cast<float>(columns)/tiles.width;
+    int j;
+
+    TileFrequencies(src, channel, tiles, frequencies);
+    cv::parallel_for_(cv::Range(0, tiles.area()), [&](const cv::Range &range) {
+        for (int tile=range.start;tile<range.end;tile++) {
+            int tilePixels = StripeRows(tile / tiles.width, tiles.height, rows).size() *
+                             StripeRows(tile % tiles.width, tiles.width, columns).size();
+            ClippedEqualizationLUT(frequencies[tile], std::max(tilePixels, 1), clipLimit, &tables[tile*256]);
+        }
+    });
+
+    // Horizontal neighbours and weights are the same for every row
+    for (j=0;j<columns;j++) {
+        float position = (j + 0.5f)/tileWidth - 0.5f;
+        int left = cvFloor(position);
+        rightWeight[j] = position - left;
+        leftTile[j] = std::min(std::max(left, 0), tiles.width-1);
+        rightTile[j] = std::min(std::max(left+1, 0), tiles.width-1);
+    }
+
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+        for (int i=range.start;i<range.end;i++) {
+            float position = (i + 0.5f)/tileHeight - 0.5f;
+            int top = cvFloor(position);
+            float bottomWeight = position - top;
+            const uchar *topTables = &tables[std::min(std::max(top, 0), tiles.height-1)*tiles.width*256];
+            const uchar *bottomTables = &tables[std::min(std::max(top+1, 0), tiles.height-1)*tiles.width*256];
+            const uchar *row = src.ptr(i);
+            uchar *outRow = out.ptr(i);
+
+            for (int j=0;j<columns;j++) {
+                int value = row[j*srcChannels + channel];
+                float topValue = topTables[leftTile[j]*256 + value] +
+                                 rightWeight[j]*(topTables[rightTile[j]*256 + value] - topTables[leftTile[j]*256 + value]);
+                float bottomValue = bottomTables[leftTile[j]*256 + value] +
+                                    rightWeight[j]*(bottomTables[rightTile[j]*256 + value] - bottomTables[leftTile[j]*256 + value]);
+                uchar result = cv::saturate_cast<uchar>(topValue + bottomWeight*(bottomValue - topValue));
+
+                if (broadcast) {
+                    for (int k=0;k<outColours;k++) {
+                        outRow[j*outChannels + k] = result;
+                    }
+                } else {
+                    outRow[j*outChannels + channel] = result;
                 }
-                pixelBuffer[k] = static_cast<unsigned char>(colorBuffer);
             }
-            newImg.at<cv::Vec3b>(i,j) = pixelBuffer;
         }
+    });
+}
+
+void AdaptiveEqualization(const cv::Mat &img, cv::OutputArray dst, bool grey, cv::Size tiles, double clipLimit) {
+    auto equalize = [&](cv::Mat &copy) {AdaptiveEqualization(copy, copy, grey, tiles, clipLimit);};
+    if (ThroughInterleaved(img, dst, equalize) || Through8Bit(img, dst, equalize)) {return;}
+
+    if (grey || img.channels() == 1) {
+        cv::Mat newImg = CreateOutput(dst, img.size(), img.type(), img, true);
+        AdaptiveChannel(img, 0, newImg, true, tiles, clipLimit);
+        CopyAlpha(img, newImg);
+        return;
     }
 
-    return newImg;
+    // Colour images are equalized on L* only, so hues are kept
+    cv::Mat labImg = PooledMat(img.size(), CV_8UC3);
+    cv::cvtColor(img, labImg, cv::COLOR_BGR2Lab);
+    AdaptiveChannel(labImg, 0, labImg, false, tiles, clipLimit);
+
+    cv::Mat newImg = CreateOutput(dst, img.size(), img.type(), img, true);
+    LabToColours(labImg, img, newImg);
 }
 
-cv::Mat Contrast(cv::Mat img, float gain) {
-    cv::Mat newImg = cv::Mat::zeros(img.size(), img.type());
-    cv::Vec3b pixelBuffer;
-    int colorBuffer;
-    int i, j, k;
-    const int rows=img.rows, columns=img.cols;
 
-    for (i=0;i<rows;i++) {
-        for (j=0;j<columns;j++) {
-            pixelBuffer = img.at<cv::Vec3b>(i,j);
-            for (k=0;k<3;k++) {
-                colorBuffer = static_cast<int>(std::floor(pixelBuffer[k] * gain));
-                if (colorBuffer > 255) {
-                    colorBuffer = 255;
+// Minimum and maximum of one channel, reduced per stripe of rows in parallel
+static void ChannelRange(const cv::Mat &img, int channel, int &minShade, int &maxShade) {
+    const int rows=img.rows, columns=img.cols, channels=img.channels();
+    const int stripes = RowStripes(rows);
+    std::vector<int> stripeMin(stripes, 255), stripeMax(stripes, 0);
+    int s;
+
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range) {
+        for (int stripe=range.start;stripe<range.end;stripe++) {
+            cv::Range stripeRows = StripeRows(stripe, stripes, rows);
+            int localMin = 255, localMax = 0;
+
+#if CV_SIMD
+            cv::v_uint8 vMin = cv::vx_setall_u8(255), vMax = cv::vx_setzero_u8();
+#endif
+            for (int i=stripeRows.start;i<stripeRows.end;i++) {
+                const uchar *row = img.ptr(i);
+                int j = 0;
+#if CV_SIMD
+                if (channels == 3) {
+                    cv::v_uint8 planes[3];
+                    for (;j<=columns-SIMD_U8_LANES;j+=SIMD_U8_LANES) {
+                        cv::v_load_deinterleave(row + j*3, planes[0], planes[1], planes[2]);
+                        vMin = cv::v_min(vMin, planes[channel]);
+                        vMax = cv::v_max(vMax, planes[channel]);
+                    }
                 }
-                pixelBuffer[k] = static_cast<unsigned char>(colorBuffer);
+#endif
+                for (;j<columns;j++) {
+                    uchar value = row[j*channels + channel];
+                    if (value < localMin) {localMin = value;}
+                    if (value > localMax) {localMax = value;}
+                }
+            }
+#if CV_SIMD
+            uchar lanes[2][SIMD_U8_LANES];
+            cv::v_store(lanes[0], vMin);
+            cv::v_store(lanes[1], vMax);
+            for (int k=0;k<SIMD_U8_LANES;k++) {
+                if (lanes[0][k] < localMin) {localMin = lanes[0][k];}
+                if (lanes[1][k] > localMax) {localMax = lanes[1][k];}
             }
-            newImg.at<cv::Vec3b>(i,j) = pixelBuffer;
+#endif
+            stripeMin[stripe] = localMin;
+            stripeMax[stripe] = localMax;
         }
+    });
+
+    minShade = 255;
+    maxShade = 0;
+    for (s=0;s<stripes;s++) {
+        if (stripeMin[s] < minShade) {minShade = stripeMin[s];}
+        if (stripeMax[s] > maxShade) {maxShade = stripeMax[s];}
     }
+}
+
+/* Shade every luminance ends up with. The bins walk is only done once per possible
+value here, so applying it costs the same whatever numShades is. */
+static void QuantizationTable(int minShade, int maxShade, int numShades, uchar table[256]) {
+    float tBin, base;
+    bool shadeFound;
+    int value;
 
-    return newImg;
+    tBin = ((float)maxShade-(float)minShade+1.0)/numShades;
+    for (value=0;value<256;value++) {
+        base = minShade-0.5+tBin;
+        shadeFound = false;
+        while (base < 255 && !shadeFound) {
+            if (value < base) {
+                base -= tBin/2;
+                table[value] = (int)base;
+                shadeFound = true;
+            } else {
+                base += tBin;
+            }
+        }
+        if (!shadeFound) {table[value] = (int)(base-tBin/2.0);}
+    }
+}
+
+void Quantization(const cv::Mat &img, cv::OutputArray dst, int numShades) {
+    // Wider depths, float included, are quantized on an 8-bit copy like the other histogram operations
+    auto quantize = [numShades](cv::Mat &copy) {Quantization(copy, copy, numShades);};
+    if (ThroughInterleaved(img, dst, quantize) || Through8Bit(img, dst, quantize)) {return;}
+
+    const int channels = img.channels();
+    cv::Mat lut(1, 256, CV_8UC(channels));
+    int minShade, maxShade, k, value;
+    uchar table[256];
+
+    ChannelRange(img, 0, minShade, maxShade);
+
+    if (numShades >= maxShade-minShade+1) {
+        cv::Mat newImg = CreateOutput(dst, img.size(), img.type(), img, true);
+        if (newImg.data != img.data) {
+            img.copyTo(newImg);
+        }
+        return;
+    }
+
+    // The table is built before the output is touched, so dst may be img
+    QuantizationTable(minShade, maxShade, numShades, table);
+    for (value=0;value<256;value++) {
+        for (k=0;k<channels;k++) {
+            // Alpha goes through unchanged
+            lut.ptr()[value*channels + k] = k == 3 ? uchar(value) : table[value];
+        }
+    }
+
+    // Every colour of a grey image holds its luminance, so cv::LUT maps them all alike
+    cv::Mat newImg = CreateOutput(dst, img.size(), img.type(), img, true);
+    cv::LUT(img, lut, newImg);
+}
+
+void Brightness(const cv::Mat &img, cv::OutputArray dst, int bias) {
+    if (ForEachPlane(img, dst, ImageSize(img), true, true, [bias](const cv::Mat &plane, cv::Mat &newPlane) {
+        Brightness(plane, newPlane, bias);
+    })) {return;}
+
+    cv::Mat newImg = CreateOutput(dst, img.size(), img.type(), img, true);
+    const int rows=img.rows, columns=img.cols;
+
+    DispatchPixel(img.type(), [&](auto format) {
+        typedef decltype(format) P;
+        typedef typename P::Type T;
+        typedef typename P::Sum Sum;
+        // bias is given in 8-bit steps
+        const Sum offset = Sum(bias * PixelMax<T>() / 255);
+
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+            for (int i=range.start;i<range.end;i++) {
+                // Float is not clamped, so its rows are one vector multiply-add
+                if constexpr (std::is_same<T, float>::value) {
+                    AffineRow<P>(img.ptr<float>(i), newImg.ptr<float>(i), columns, 1.f, float(offset));
+                } else {
+                    ColourRow<P>(img.ptr<T>(i), newImg.ptr<T>(i), columns, [offset](T value) {
+                        return ClampPixel<T>(Sum(value) + offset);
+                    });
+                }
+            }
+        });
+    });
+}
+
+void Contrast(const cv::Mat &img, cv::OutputArray dst, float gain) {
+    if (ForEachPlane(img, dst, ImageSize(img), true, true, [gain](const cv::Mat &plane, cv::Mat &newPlane) {
+        Contrast(plane, newPlane, gain);
+    })) {return;}
+
+    cv::Mat newImg = CreateOutput(dst, img.size(), img.type(), img, true);
+    const int rows=img.rows, columns=img.cols;
+
+    DispatchPixel(img.type(), [&](auto format) {
+        typedef decltype(format) P;
+        typedef typename P::Type T;
+
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+            for (int i=range.start;i<range.end;i++) {
+                if constexpr (std::is_same<T, float>::value) {
+                    AffineRow<P>(img.ptr<float>(i), newImg.ptr<float>(i), columns, gain, 0.f);
+                } else {
+                    ColourRow<P>(img.ptr<T>(i), newImg.ptr<T>(i), columns, [gain](T value) {
+                        return ClampPixel<T>(value * gain);
+                    });
+                }
+            }
+        });
+    });
 }
@@ -2,21 +2,113 @@
 #define IMAGEMATRIX_HPP
 
 #include <opencv2/opencv.hpp>
+#include <functional>
+#include <string>
 
-bool IsGrey(cv::Mat img);
-
-cv::Mat InvertVertically(cv::Mat img);
-cv::Mat InvertHorizontally(cv::Mat img);
-cv::Mat GreyScale(cv::Mat img);
-cv::Mat Negative(cv::Mat img);
-cv::Mat Enlarge(cv::Mat img);
-cv::Mat Reduce(cv::Mat img, int sx, int sy);
-cv::Mat Rotate90(cv::Mat img);
-cv::Mat Convolution(cv::Mat img, double kernel[3][3], bool clampping);
-cv::Mat Equalization(cv::Mat img);
-cv::Mat Lab(cv::Mat img);
-cv::Mat Quantization(cv::Mat img, int numShades);
-cv::Mat Brightness(cv::Mat img, int bias);
-cv::Mat Contrast(cv::Mat img, float gain);
-
-#endif
\ No newline at end of file
+/* Every operation reads img and writes dst, which is (re)allocated from the buffer
+pool only when it does not already have the right size and type. Point operations,
+Equalization, Lab and Quantization accept dst == img and then work in place.
+
+Images may be 8-bit, 16-bit or float (full scale 1.0), with 1, 3 or 4 channels.
+A fourth channel is straight (not premultiplied) alpha: colour operations keep it,
+while resampling and Convolution weight colours by it.
+Histogram operations (Equalization, Lab, AdaptiveEqualization and Quantization)
+compute on 256 levels whatever the depth.
+
+Images are either interleaved (2-D, 1, 3 or 4 channels) or planar: 3-D Mats of
+planes x rows x columns with one channel, so each colour is a contiguous image.
+Per-channel kernels run a straight single-channel loop on every plane, the others
+go through an interleaved copy. Use ImageSize and ImageChannels for either layout.
+
+Greyness is carried forward: a grey input always gives a grey output, and GreyScale
+and the luma modes of Convolution and Gradient always give grey outputs, so callers
+can keep a flag instead of calling IsGrey again after each operation. */
+
+// Layout:
+bool IsPlanar(const cv::Mat &img);
+cv::Size ImageSize(const cv::Mat &img);
+int ImageChannels(const cv::Mat &img);
+void ToPlanar(const cv::Mat &img, cv::OutputArray dst);
+void ToInterleaved(const cv::Mat &img, cv::OutputArray dst);
+// Header of the pixels of img inside rect, for either layout
+cv::Mat Region(const cv::Mat &img, cv::Rect rect);
+/* Every step-th pixel of every step-th row, interleaved and at the depth of img, for
+charts that only need a proxy: the cost follows the sample, not the image. */
+cv::Mat Subsample(const cv::Mat &img, int step);
+// from.copyTo(to, mask) for either layout, an empty mask copies everything
+void CopyMasked(const cv::Mat &from, cv::Mat to, const cv::Mat &mask);
+
+/* Runs kernel(src, dst), a same-size operation, on the pixels of img inside region only,
+and only where mask (region sized, optional) is set. Cost follows the region, not the
+image. A margin of pixels around region is read by neighbourhood kernels but never
+written. region may reach past img, as when a selection is replayed on a smaller image:
+it is clipped, and mask with it. img is cloned first if it shares its buffer. */
+void ApplyInRegion(cv::Mat &img, cv::Rect region, const cv::Mat &mask, int margin,
+                   const std::function<void(const cv::Mat&, cv::Mat&)> &kernel);
+
+bool IsGrey(const cv::Mat &img);
+
+void InvertVertically(const cv::Mat &img, cv::OutputArray dst);
+void InvertHorizontally(const cv::Mat &img, cv::OutputArray dst);
+void GreyScale(const cv::Mat &img, cv::OutputArray dst);
+void Negative(const cv::Mat &img, cv::OutputArray dst);
+void Enlarge(const cv::Mat &img, cv::OutputArray dst);
+void Reduce(const cv::Mat &img, cv::OutputArray dst, int sx, int sy);
+void Rotate90(const cv::Mat &img, cv::OutputArray dst);
+/* 3x3 filter over the whole image. Pixels outside it are taken by border, one of
+cv::BORDER_REPLICATE, BORDER_REFLECT_101, BORDER_WRAP or BORDER_CONSTANT (zero).
+With luma, colour images are filtered on their luma, computed row by row as the
+filter goes, and the grey result written to every colour. */
+void Convolution(const cv::Mat &img, cv::OutputArray dst, const double kernel[3][3], bool clampping,
+                 int border = cv::BORDER_REPLICATE, bool luma = false);
+/* Gradient magnitude of every colour, Gx and Gy coming from one pass over the 3x3
+neighbourhood: Sobel for weight 2, Prewitt for weight 1, L2 or L1 norm. The magnitude
+is divided by 2 + weight, so a full step along one axis is full scale. With luma, colour
+images give the gradient of their luma, fused like Convolution, in every colour.
+direction, when given, gets atan2(Gy, Gx) in radians as float with the channels of img
+(interleaved), or one channel with luma. */
+void Gradient(const cv::Mat &img, cv::OutputArray dst, int weight, bool l2, int border = cv::BORDER_REPLICATE,
+              bool luma = false, cv::OutputArray direction = cv::noArray());
+/* Canny edges of the luma: Sobel gradient, non-maximum suppression and hysteresis
+between low and high, fractions of full scale. Edges are white on black. */
+void Canny(const cv::Mat &img, cv::OutputArray dst, double low, double high, int border = cv::BORDER_REPLICATE);
+/* Gaussian blur of any sigma as three stacked box filters, made of running sums along
+rows and then down strips of columns, so the cost does not grow with sigma. */
+void Gaussian(const cv::Mat &img, cv::OutputArray dst, double sigma, int border = cv::BORDER_REPLICATE);
+// Pixels around each pixel read by Gaussian
+int GaussianMargin(double sigma);
+/* Colour-preserving unsharp mask: adds amount times the luma detail above the blur of
+Gaussian (same sigma, same boxes) to every colour, where that detail reaches threshold
+(fraction of full scale).
+Fused and streamed by rows, without full-frame temporaries. */
+void UnsharpMask(const cv::Mat &img, cv::OutputArray dst, double amount, double sigma, double threshold,
+                 int border = cv::BORDER_REPLICATE);
+// Pixels around each pixel read by UnsharpMask
+int UnsharpMargin(double sigma);
+/* Median of the (2 radius + 1)^2 window of every channel. Radii 1 and 2 run a sorting
+network on SIMD lanes, larger ones a histogram median whose cost does not grow with
+the radius (on 256 levels, like the histogram operations). */
+void Median(const cv::Mat &img, cv::OutputArray dst, int radius, int border = cv::BORDER_REPLICATE);
+/* Edge-preserving smoothing, approximated with a bilateral grid: spatial is the
+sigma in pixels, range the sigma of luma as a fraction of full scale. */
+void Bilateral(const cv::Mat &img, cv::OutputArray dst, int spatial, double range);
+void Equalization(const cv::Mat &img, cv::OutputArray dst);
+void Lab(const cv::Mat &img, cv::OutputArray dst);
+void AdaptiveEqualization(const cv::Mat &img, cv::OutputArray dst, bool grey, cv::Size tiles, double clipLimit);
+/* Maps every colour to one of numShades shades spread over the range of the first
+channel, through a 256-entry table. Callers grey the image first, so it stays grey. */
+void Quantization(const cv::Mat &img, cv::OutputArray dst, int numShades);
+void Brightness(const cv::Mat &img, cv::OutputArray dst, int bias);
+void Contrast(const cv::Mat &img, cv::OutputArray dst, float gain);
+
+/* Decodes path for editing as BGR or BGRA, keeping alpha and 16-bit or float samples.
+Returns an empty image on failure, like cv::imread. */
+cv::Mat ReadImage(const std::string &path);
+// Rescales between full ranges (255, 65535, 1.0), saturating into integer depths
+void ConvertDepth(const cv::Mat &img, cv::OutputArray dst, int depth);
+// Interleaved 8-bit copy of img for Qt, the charts and JPEG, or img itself when it already is one
+cv::Mat DisplayDepth(const cv::Mat &img);
+// Same for PNG, which keeps 16-bit samples: only float is narrowed, to 16-bit
+cv::Mat EncoderDepth(const cv::Mat &img);
+
+#endif
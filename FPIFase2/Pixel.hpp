@@ -0,0 +1,82 @@
+#ifndef PIXEL_HPP
+#define PIXEL_HPP
+
+#include <opencv2/core.hpp>
+#include <limits>
+#include <type_traits>
+
+/* Compile-time pixel layout for the kernels. DispatchPixel looks at the Mat type once
+and calls function with a PixelFormat tag, so every kernel body is instantiated (and
+vectorized) separately for each supported depth and channel count:
+    8-bit, 16-bit and float, with 1 (grey), 3 (BGR) or 4 (BGRA) channels.
+A fourth channel is alpha and colour operations leave it alone. */
+template <typename T, int CN>
+struct PixelFormat {
+    typedef T Type;
+    typedef cv::Vec<T, CN> Vec;
+    // Wide enough for sums of a few pixels without overflow
+    typedef typename std::conditional<std::is_integral<T>::value, int, float>::type Sum;
+    static constexpr int Channels = CN;
+    static constexpr int Colours = CN == 4 ? 3 : CN;
+};
+
+// Full scale of a channel: 255, 65535, or 1 for float
+template <typename T>
+constexpr double PixelMax() {
+    return std::is_floating_point<T>::value ? 1.0 : double(std::numeric_limits<T>::max());
+}
+
+// Middle grey, as the integer kernels have always used it (127 for 8-bit)
+template <typename T>
+constexpr double PixelMid() {
+    return std::is_floating_point<T>::value ? 0.5 : double(std::numeric_limits<T>::max() / 2);
+}
+
+// PixelMax for a run-time depth
+inline double DepthMax(int depth) {
+    switch (depth) {
+        case CV_8U: return PixelMax<uchar>();
+        case CV_16U: return PixelMax<ushort>();
+        case CV_32F: return PixelMax<float>();
+        default: CV_Error(cv::Error::StsUnsupportedFormat, "Only 8-bit, 16-bit and float images are supported");
+    }
+    return 1;
+}
+
+/* Integer depths are clamped to [0, PixelMax] and truncated, like the original 8-bit
+kernels. Float keeps out-of-range values, so a later stage can bring them back, and
+they are only clipped when narrowed for display or saving. */
+template <typename T, typename V>
+inline T ClampPixel(V value) {
+    if constexpr (std::is_floating_point<T>::value) {
+        return static_cast<T>(value);
+    }
+    if (value > V(PixelMax<T>())) {
+        return T(PixelMax<T>());
+    } else if (value < V(0)) {
+        return T(0);
+    }
+    return static_cast<T>(value);
+}
+
+template <typename T, typename Function>
+inline void DispatchChannels(int channels, Function &&function) {
+    switch (channels) {
+        case 1: function(PixelFormat<T, 1>()); break;
+        case 3: function(PixelFormat<T, 3>()); break;
+        case 4: function(PixelFormat<T, 4>()); break;
+        default: CV_Error(cv::Error::StsUnsupportedFormat, "Only 1, 3 and 4 channel images are supported");
+    }
+}
+
+template <typename Function>
+inline void DispatchPixel(int type, Function &&function) {
+    switch (CV_MAT_DEPTH(type)) {
+        case CV_8U: DispatchChannels<uchar>(CV_MAT_CN(type), function); break;
+        case CV_16U: DispatchChannels<ushort>(CV_MAT_CN(type), function); break;
+        case CV_32F: DispatchChannels<float>(CV_MAT_CN(type), function); break;
+        default: CV_Error(cv::Error::StsUnsupportedFormat, "Only 8-bit, 16-bit and float images are supported");
+    }
+}
+
+#endif
@@ -0,0 +1,178 @@
+#include "Profiler.hpp"
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <sys/resource.h>
+#include <opencv2/opencv.hpp>
+#include "BufferPool.hpp"
+
+#define SUMMARY_NAME_WIDTH 22
+
+/* Default allocator of the Mats not drawn from the pool: OpenCV's own, counting the bytes
+it hands out. With the pool's count, samples get what they allocate, temporaries freed
+before the end included, instead of the net heap growth. */
+class CountingAllocator : public cv::MatAllocator {
+
+public:
+    mutable std::atomic<long long> bytes{0};
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override {
+        // The buffer's own UMatData names the standard allocator, which frees it
+        cv::UMatData *u = cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+        if (u && !data) {
+            bytes += static_cast<long long>(u->size);
+        }
+        return u;
+    }
+    bool allocate(cv::UMatData *data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override {
+        return cv::Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+    }
+    void deallocate(cv::UMatData *data) const override {
+        cv::Mat::getStdAllocator()->deallocate(data);
+    }
+};
+
+static CountingAllocator &Counting() {
+    // Installed once for the whole process, and never destroyed, like the pool
+    static CountingAllocator *counting = []() {
+        CountingAllocator *allocator = new CountingAllocator();
+        cv::Mat::setDefaultAllocator(allocator);
+        return allocator;
+    }();
+    return *counting;
+}
+
+// Init:
+Profiler::Profiler(): origin(std::chrono::steady_clock::now()) {
+    Counting();
+}
+
+Profiler::Snapshot Profiler::TakeSnapshot() const {
+    Snapshot snapshot;
+    struct timespec cpuTime;
+    struct rusage usage;
+
+    snapshot.wallUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuTime);
+    snapshot.cpuUs = cpuTime.tv_sec*1e6 + cpuTime.tv_nsec/1e3;
+
+    // Running totals, so a sample is their difference and never negative
+    snapshot.allocatedBytes = Counting().bytes + static_cast<long long>(BufferPool::Instance().GetAllocatedBytes());
+
+    getrusage(RUSAGE_SELF, &usage);
+    snapshot.peakRssKb = usage.ru_maxrss;
+
+    return snapshot;
+}
+
+void Profiler::Fill(ProfileSample &sample, const Snapshot &start, const Snapshot &end) {
+    sample.startUs = start.wallUs;
+    sample.wallUs = end.wallUs - start.wallUs;
+    sample.cpuUs = end.cpuUs - start.cpuUs;
+    sample.allocatedBytes = end.allocatedBytes - start.allocatedBytes;
+    sample.peakRssKb = end.peakRssKb - start.peakRssKb;
+}
+
+// Recording:
+void Profiler::BeginOperation(const std::string &name) {
+    currentOperation = ProfileSample();
+    currentOperation.name = name;
+    inOperation = true;
+    inPhase = false;
+    operationStart = TakeSnapshot();
+}
+
+void Profiler::EndOperation() {
+    if (!inOperation) {return;}
+    if (inPhase) {EndPhase();}
+
+    Fill(currentOperation, operationStart, TakeSnapshot());
+    operations.push_back(currentOperation);
+    inOperation = false;
+}
+
+void Profiler::BeginPhase(const std::string &name) {
+    if (!inOperation) {return;}
+    if (inPhase) {EndPhase();}
+
+    currentPhase = ProfileSample();
+    currentPhase.name = name;
+    inPhase = true;
+    phaseStart = TakeSnapshot();
+}
+
+void Profiler::EndPhase() {
+    if (!inPhase) {return;}
+
+    Fill(currentPhase, phaseStart, TakeSnapshot());
+    currentOperation.phases.push_back(currentPhase);
+    inPhase = false;
+}
+
+// Reports:
+const std::vector<ProfileSample> &Profiler::GetOperations() const {
+    return operations;
+}
+
+std::string Profiler::Summary(int lastOperations) const {
+    std::ostringstream text;
+    char line[128];
+    int first = static_cast<int>(operations.size()) - lastOperations;
+    int i;
+
+    snprintf(line, sizeof(line), "%-*s %8s %8s %9s %8s\n", SUMMARY_NAME_WIDTH, "Operation",
+             "wall ms", "cpu ms", "alloc KB", "rss KB");
+    text << line;
+
+    for (i=(first < 0 ? 0 : first);i<static_cast<int>(operations.size());i++) {
+        const ProfileSample &operation = operations[i];
+        snprintf(line, sizeof(line), "%-*.*s %8.2f %8.2f %9lld %8ld\n", SUMMARY_NAME_WIDTH, SUMMARY_NAME_WIDTH,
+                 operation.name.c_str(), operation.wallUs/1e3, operation.cpuUs/1e3,
+                 operation.allocatedBytes/1024, operation.peakRssKb);
+        text << line;
+
+        for (const ProfileSample &phase : operation.phases) {
+            snprintf(line, sizeof(line), "  %-*.*s %8.2f %8.2f %9lld %8ld\n", SUMMARY_NAME_WIDTH-2, SUMMARY_NAME_WIDTH-2,
+                     phase.name.c_str(), phase.wallUs/1e3, phase.cpuUs/1e3,
+                     phase.allocatedBytes/1024, phase.peakRssKb);
+            text << line;
+        }
+    }
+
+    return text.str();
+}
+
+static void WriteTraceEvent(std::ofstream &file, const ProfileSample &sample, bool &first) {
+    char line[512];
+
+    // Complete ("X") events nest by time, so phases show up under their operation
+    snprintf(line, sizeof(line),
+             "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,"
+             "\"args\":{\"cpu_us\":%.3f,\"allocated_bytes\":%lld,\"peak_rss_kb\":%ld}}",
+             first ? "" : ",", sample.name.c_str(), sample.startUs, sample.wallUs,
+             sample.cpuUs, sample.allocatedBytes, sample.peakRssKb);
+    file << line;
+    first = false;
+}
+
+bool Profiler::ExportChromeTrace(const std::string &path) const {
+    std::ofstream file(path);
+    bool first = true;
+
+    if (!file.is_open()) {return false;}
+
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (const ProfileSample &operation : operations) {
+        WriteTraceEvent(file, operation, first);
+        for (const ProfileSample &phase : operation.phases) {
+            WriteTraceEvent(file, phase, first);
+        }
+    }
+    file << "\n]}\n";
+
+    return file.good();
+}
@@ -0,0 +1,54 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct ProfileSample {
+    std::string name;
+    double startUs = 0;         // Since the profiler was created
+    double wallUs = 0;
+    double cpuUs = 0;           // Summed over every thread of the process
+    long long allocatedBytes = 0;   // Image buffers allocated during the sample, freed or not
+    long peakRssKb = 0;         // How much the peak resident set grew
+    std::vector<ProfileSample> phases;
+};
+
+class Profiler {
+
+private:
+    struct Snapshot {
+        double wallUs;
+        double cpuUs;
+        long long allocatedBytes;
+        long peakRssKb;
+    };
+
+    std::chrono::steady_clock::time_point origin;
+    std::vector<ProfileSample> operations;
+    ProfileSample currentOperation, currentPhase;
+    Snapshot operationStart, phaseStart;
+    bool inOperation = false,
+         inPhase = false;
+
+    Snapshot TakeSnapshot() const;
+    static void Fill(ProfileSample &sample, const Snapshot &start, const Snapshot &end);
+
+public:
+    // Init:
+    Profiler();
+
+    // Recording (phases are only kept while an operation is open):
+    void BeginOperation(const std::string &name);
+    void EndOperation();
+    void BeginPhase(const std::string &name);
+    void EndPhase();
+
+    // Reports:
+    const std::vector<ProfileSample> &GetOperations() const;
+    std::string Summary(int lastOperations) const;
+    bool ExportChromeTrace(const std::string &path) const;
+};
+
+#endif
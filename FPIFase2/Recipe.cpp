@@ -0,0 +1,254 @@
+#include "Recipe.hpp"
+#include "BufferPool.hpp"
+#include "ImageMatrix.hpp"
+
+// Recording:
+void Recipe::Clear() {
+    steps.clear();
+    region = cv::Rect();
+    mask.release();
+    quantized = false;
+    bright = false;
+    contrast = false;
+    toneStep = -1;
+}
+
+void Recipe::Add(Operation operation, int sx, int sy, double clipLimit, double amount) {
+    Step step;
+    step.operation = operation;
+    step.sx = sx;
+    step.sy = sy;
+    step.clipLimit = clipLimit;
+    step.amount = amount;
+    step.region = region;
+    step.mask = mask;
+    steps.push_back(step);
+}
+
+void Recipe::AddFilter(const double kernel[3][3], bool clampping, int border, bool luma) {
+    int i, j;
+    Step step;
+
+    step.operation = Filter;
+    for (i=0;i<3;i++) {
+        for (j=0;j<3;j++) {
+            step.kernel[i][j] = kernel[i][j];
+        }
+    }
+    step.clampping = clampping;
+    step.border = border;
+    step.luma = luma;
+    step.region = region;
+    step.mask = mask;
+    steps.push_back(step);
+}
+
+void Recipe::AddGradient(int weight, bool l2, int border, bool luma) {
+    Step step;
+
+    step.operation = Gradient;
+    step.weight = weight;
+    step.l2 = l2;
+    step.border = border;
+    step.luma = luma;
+    step.region = region;
+    step.mask = mask;
+    steps.push_back(step);
+}
+
+void Recipe::AddCanny(double low, double high, int border) {
+    Step step;
+
+    step.operation = Canny;
+    step.low = low;
+    step.high = high;
+    step.border = border;
+    step.region = region;
+    step.mask = mask;
+    steps.push_back(step);
+}
+
+void Recipe::AddMedian(int radius, int border) {
+    Step step;
+
+    step.operation = Median;
+    step.radius = radius;
+    step.border = border;
+    step.region = region;
+    step.mask = mask;
+    steps.push_back(step);
+}
+
+void Recipe::AddBilateral(int spatial, double range) {
+    Step step;
+
+    step.operation = Bilateral;
+    step.radius = spatial;
+    step.range = range;
+    step.region = region;
+    step.mask = mask;
+    steps.push_back(step);
+}
+
+void Recipe::AddGaussian(double sigma, int border) {
+    Step step;
+
+    step.operation = Gaussian;
+    step.sigma = sigma;
+    step.border = border;
+    step.region = region;
+    step.mask = mask;
+    steps.push_back(step);
+}
+
+void Recipe::AddUnsharp(double amount, double sigma, double threshold, int border) {
+    Step step;
+
+    step.operation = Unsharp;
+    step.amount = amount;
+    step.sigma = sigma;
+    step.threshold = threshold;
+    step.border = border;
+    step.region = region;
+    step.mask = mask;
+    steps.push_back(step);
+}
+
+void Recipe::SetQuantization(int numShades) {
+    lastQuantity = numShades;
+    quantized = true;
+}
+
+void Recipe::SetBrightness(int bias) {
+    lastBrightness = bias;
+    bright = true;
+}
+
+void Recipe::SetContrast(float gain) {
+    lastContrast = gain;
+    contrast = true;
+}
+
+void Recipe::SetWorkingDepth(int depth) {
+    workingDepth = depth;
+}
+
+void Recipe::SetRegion(cv::Rect newRegion, const cv::Mat &newMask) {
+    region = newRegion;
+    mask = newMask;
+    toneStep = -1;
+}
+
+void Recipe::SetRegionTone(int bias, float gain) {
+    if (toneStep < 0 || toneStep != int(steps.size())-1) {
+        Add(Tone);
+        toneStep = int(steps.size())-1;
+    }
+    steps[toneStep].amount = bias;
+    steps[toneStep].gain = gain;
+}
+
+bool Recipe::Empty() const {
+    return steps.empty() && !quantized && !bright && !contrast;
+}
+
+// Same-size steps, which may run on a selection only
+static void SameSizeStep(const Recipe::Step &step, bool grey, const cv::Mat &src, cv::Mat &dst) {
+    switch (step.operation) {
+        case Recipe::Greyscale: GreyScale(src, dst); break;
+        case Recipe::Negative: Negative(src, dst); break;
+        case Recipe::Filter: Convolution(src, dst, step.kernel, step.clampping, step.border, step.luma); break;
+        case Recipe::Equalize: Equalization(src, dst); break;
+        case Recipe::LabEqualize: Lab(src, dst); break;
+        case Recipe::AdaptiveEqualize:
+            AdaptiveEqualization(src, dst, grey, cv::Size(step.sx, step.sy), step.clipLimit);
+            break;
+        // Same order as the live parameters
+        case Recipe::Tone:
+            ::Contrast(src, dst, step.gain);
+            ::Brightness(dst, dst, int(step.amount));
+            break;
+        case Recipe::Gradient: ::Gradient(src, dst, step.weight, step.l2, step.border, step.luma); break;
+        case Recipe::Canny: ::Canny(src, dst, step.low, step.high, step.border); break;
+        case Recipe::Median: ::Median(src, dst, step.radius, step.border); break;
+        case Recipe::Bilateral: ::Bilateral(src, dst, step.radius, step.range); break;
+        case Recipe::Gaussian: ::Gaussian(src, dst, step.sigma, step.border); break;
+        case Recipe::Unsharp: UnsharpMask(src, dst, step.amount, step.sigma, step.threshold, step.border); break;
+        default: break;
+    }
+}
+
+// Pixels read around a selection by neighbourhood steps
+static int StepMargin(const Recipe::Step &step) {
+    switch (step.operation) {
+        case Recipe::Filter:
+        case Recipe::Gradient: return 1;
+        // Non-maximum suppression compares gradients, which read one pixel further
+        case Recipe::Canny: return 2;
+        case Recipe::Median: return step.radius;
+        // The grid blur reaches about two cells away
+        case Recipe::Bilateral: return step.radius*2;
+        case Recipe::Gaussian: return GaussianMargin(step.sigma);
+        case Recipe::Unsharp: return UnsharpMargin(step.sigma);
+        default: return 0;
+    }
+}
+
+// Replay, with the same buffer handling as the manager
+void Recipe::Apply(const cv::Mat &img, cv::Mat &dst) const {
+    cv::Mat buffer = img;
+    cv::Mat newBuffer;
+    bool grey = IsGrey(img);
+
+    if (workingDepth >= 0 && img.depth() != workingDepth) {
+        buffer = cv::Mat();
+        ConvertDepth(img, buffer, workingDepth);
+    }
+
+    for (const Step &step : steps) {
+        switch (step.operation) {
+            case MirrorHorizontally: InvertHorizontally(buffer, buffer); break;
+            case MirrorVertically: InvertVertically(buffer, buffer); break;
+            case ZoomIn: Enlarge(buffer, buffer); break;
+            case ZoomOut: Reduce(buffer, buffer, step.sx, step.sy); break;
+            case Rotate: Rotate90(buffer, buffer); break;
+            default:
+                if (!step.region.empty()) {
+                    ApplyInRegion(buffer, step.region, step.mask, StepMargin(step),
+                                  [&step, grey](const cv::Mat &src, cv::Mat &out) {
+                        SameSizeStep(step, grey, src, out);
+                    });
+                    break;
+                }
+                newBuffer = InPlaceTarget(buffer);
+                SameSizeStep(step, grey, buffer, newBuffer);
+                buffer = newBuffer;
+                newBuffer.release();
+                // A greyscale selection leaves the rest of the image coloured
+                if (step.operation == Greyscale || step.operation == Canny || step.luma) {
+                    grey = true;
+                }
+        }
+    }
+
+    // Parameters go last, in the same order as ImageEditingManager::UpdateParameters
+    if (quantized) {
+        newBuffer = InPlaceTarget(buffer);
+        Quantization(buffer, newBuffer, lastQuantity);
+        buffer = newBuffer;
+        newBuffer.release();
+    }
+    if (contrast) {
+        newBuffer = InPlaceTarget(buffer);
+        ::Contrast(buffer, newBuffer, lastContrast);
+        buffer = newBuffer;
+        newBuffer.release();
+    }
+    if (bright) {
+        newBuffer = InPlaceTarget(buffer);
+        ::Brightness(buffer, newBuffer, lastBrightness);
+        buffer = newBuffer;
+        newBuffer.release();
+    }
+    dst = buffer;
+}
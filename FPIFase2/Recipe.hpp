@@ -0,0 +1,93 @@
+#ifndef RECIPE_HPP
+#define RECIPE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+/* Kernel calls made by an ImageEditingManager, in order, plus its current
+quantization/brightness/contrast parameters. Steps are recorded as they actually
+ran (implicit greyscale conversions and luma modes included), so Apply reproduces
+the edit on any other image without a window. Steps made under a selection keep
+its rectangle and mask, and are clipped to the image they are replayed on. */
+class Recipe {
+
+public:
+    enum Operation {
+        MirrorHorizontally, MirrorVertically, Greyscale, Negative, ZoomIn, ZoomOut, Rotate,
+        Filter, Equalize, LabEqualize, AdaptiveEqualize, Tone, Gradient, Canny,
+        Median, Bilateral, Gaussian, Unsharp
+    };
+
+    struct Step {
+        Operation operation;
+        int sx = 0,
+            sy = 0;
+        double clipLimit = 0;
+        double kernel[3][3] = {};
+        bool clampping = false;
+        int border = cv::BORDER_REPLICATE;
+        // Filter or gradient of the luma, giving a grey image
+        bool luma = false;
+        // Gradient operator weight (Sobel 2, Prewitt 1) and norm, Canny thresholds
+        int weight = 0;
+        bool l2 = false;
+        double low = 0,
+               high = 0;
+        // Median radius or bilateral spatial sigma, bilateral range sigma
+        int radius = 0;
+        double range = 0;
+        // Gaussian and unsharp mask sigma, unsharp mask threshold
+        double sigma = 0,
+               threshold = 0;
+        // Brightness bias applied to a selection (after its contrast gain), unsharp mask amount
+        double amount = 0;
+        float gain = 1;
+        cv::Rect region;
+        cv::Mat mask;
+    };
+
+private:
+    std::vector<Step> steps;
+    cv::Rect region;
+    cv::Mat mask;
+    bool quantized = false,
+         bright = false,
+         contrast = false;
+    int lastQuantity = 0,
+        lastBrightness = 0;
+    float lastContrast = 0;
+    // Step of the current selection's brightness and contrast, -1 before the first
+    int toneStep = -1;
+    // Depth the editor ran the steps at, -1 for the depth of each image
+    int workingDepth = -1;
+
+public:
+    // Recording:
+    void Clear();
+    void Add(Operation operation, int sx = 0, int sy = 0, double clipLimit = 0, double amount = 0);
+    void AddFilter(const double kernel[3][3], bool clampping, int border, bool luma);
+    void AddGradient(int weight, bool l2, int border, bool luma);
+    void AddCanny(double low, double high, int border);
+    void AddMedian(int radius, int border);
+    void AddBilateral(int spatial, double range);
+    void AddGaussian(double sigma, int border);
+    void AddUnsharp(double amount, double sigma, double threshold, int border);
+    void SetQuantization(int numShades);
+    void SetBrightness(int bias);
+    void SetContrast(float gain);
+    // Kept by Clear: it belongs to the editor, not to the edit
+    void SetWorkingDepth(int depth);
+    // Selection for the steps added next, an empty region is the whole image
+    void SetRegion(cv::Rect newRegion, const cv::Mat &newMask);
+    /* Brightness and contrast baked into the selection, from its pixels before them. There
+    is one step per selection: later calls update it until another step is added. */
+    void SetRegionTone(int bias, float gain);
+    bool Empty() const;
+
+    /* Replay (thread safe, img is only read). img is converted to the working depth first,
+    so steps clamp and round as they did in the editor, and dst stays at that depth for
+    the caller to quantize when encoding. */
+    void Apply(const cv::Mat &img, cv::Mat &dst) const;
+};
+
+#endif
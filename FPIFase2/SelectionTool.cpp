@@ -0,0 +1,118 @@
+#include "SelectionTool.hpp"
+#include <QMouseEvent>
+#include <QPainter>
+#include <QPen>
+#include <vector>
+
+// Drags shorter than this are clicks, which clear the selection
+#define MIN_DRAG 3
+
+// Init:
+SelectionTool::SelectionTool(QLabel *label): QWidget(label), label(label) {
+    setAttribute(Qt::WA_TransparentForMouseEvents);
+    setGeometry(0, 0, label->width(), label->height());
+    label->installEventFilter(this);
+}
+
+// Get, set, others:
+void SelectionTool::SetMode(Mode newMode) {
+    mode = newMode;
+    dragging = false;
+}
+
+void SelectionTool::SetCallback(std::function<void(cv::Rect, const cv::Mat&)> callback) {
+    selected = callback;
+}
+
+void SelectionTool::Clear() {
+    dragging = false;
+    outline.clear();
+    update();
+}
+
+// Events:
+bool SelectionTool::eventFilter(QObject *watched, QEvent *event) {
+    // The overlay follows the label, which is resized with the image
+    if (event->type() == QEvent::Resize) {
+        setGeometry(0, 0, label->width(), label->height());
+        return false;
+    }
+    if (mode == None) {return false;}
+
+    QMouseEvent *mouse = static_cast<QMouseEvent*>(event);
+    QPoint position;
+
+    switch (event->type()) {
+        case QEvent::MouseButtonPress:
+            if (mouse->button() != Qt::LeftButton) {return false;}
+            dragging = true;
+            origin = mouse->pos();
+            outline.clear();
+            outline.append(origin);
+            update();
+            return true;
+
+        case QEvent::MouseMove:
+            if (!dragging) {return false;}
+            position = mouse->pos();
+            if (mode == Rectangle) {
+                outline.clear();
+                outline.append(origin);
+                outline.append(QPoint(position.x(), origin.y()));
+                outline.append(position);
+                outline.append(QPoint(origin.x(), position.y()));
+            } else {
+                outline.append(position);
+            }
+            update();
+            return true;
+
+        case QEvent::MouseButtonRelease:
+            if (!dragging || mouse->button() != Qt::LeftButton) {return false;}
+            dragging = false;
+            Finish();
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+void SelectionTool::paintEvent(QPaintEvent *) {
+    if (outline.size() < 2) {return;}
+
+    QPainter painter(this);
+    painter.setPen(QPen(QColor(Qt::white), 1));
+    painter.drawPolygon(outline);
+    painter.setPen(QPen(QColor(Qt::black), 1, Qt::DashLine));
+    painter.drawPolygon(outline);
+}
+
+// Turns the outline into image coordinates and reports it
+void SelectionTool::Finish() {
+    std::vector<cv::Point> points;
+    cv::Rect bounds, full(0, 0, label->width(), label->height());
+    cv::Mat mask;
+    int k;
+
+    for (k=0;k<outline.size();k++) {
+        points.push_back(cv::Point(outline.at(k).x(), outline.at(k).y()));
+    }
+    if (points.size() > 1) {
+        bounds = cv::boundingRect(points) & full;
+    }
+
+    if (bounds.width < MIN_DRAG || bounds.height < MIN_DRAG || (mode == Lasso && points.size() < 3)) {
+        outline.clear();
+        update();
+        bounds = cv::Rect();
+    } else if (mode == Lasso) {
+        // The lasso closes back to its first point
+        mask = cv::Mat::zeros(bounds.size(), CV_8U);
+        cv::fillPoly(mask, std::vector<std::vector<cv::Point>>{points}, cv::Scalar(255), cv::LINE_8, 0, -bounds.tl());
+    }
+
+    if (selected) {
+        selected(bounds, mask);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef SELECTIONTOOL_HPP
+#define SELECTIONTOOL_HPP
+
+#include <opencv2/opencv.hpp>
+#include <functional>
+#include <QEvent>
+#include <QLabel>
+#include <QPaintEvent>
+#include <QPolygon>
+#include <QWidget>
+
+/* Rectangle and lasso selections drawn over the editing image. The tool is a transparent
+overlay on the image label that paints the outline, and it gets the label's mouse events
+through an event filter. Coordinates are image pixels, as the label is sized to the image.
+A finished selection is reported as its bounding rectangle plus, for a lasso, a mask of
+that size; a click without dragging reports an empty selection. */
+class SelectionTool : public QWidget {
+
+public:
+    enum Mode {None, Rectangle, Lasso};
+
+private:
+    QLabel *label;
+    Mode mode = None;
+    bool dragging = false;
+    QPoint origin;
+    QPolygon outline;
+    std::function<void(cv::Rect, const cv::Mat&)> selected;
+
+    void Finish();
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event) override;
+    void paintEvent(QPaintEvent *event) override;
+
+public:
+    // Init:
+    SelectionTool(QLabel *label);
+
+    // Get, set, others:
+    void SetMode(Mode newMode);
+    void SetCallback(std::function<void(cv::Rect, const cv::Mat&)> callback);
+    void Clear();
+};
+
+#endif
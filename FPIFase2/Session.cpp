@@ -0,0 +1,146 @@
+#include "Session.hpp"
+#include <iostream>
+#include "ImageMatrix.hpp"
+
+// Init:
+Session::Session(const std::vector<std::string> &paths, size_t maxResident, int workingDepth, bool planar):
+    documents(paths.size()), pool(ThreadPool::Instance()), maxResident(maxResident), workingDepth(workingDepth),
+    planar(planar), waiting(std::make_shared<Waiting>()) {
+    size_t k;
+
+    for (k=0;k<paths.size();k++) {
+        documents[k].path = paths[k];
+    }
+}
+
+// Decodes still queued or running outlive the session, so they must not call back into it
+Session::~Session() {
+    std::lock_guard<std::mutex> guard(waiting->lock);
+    waiting->index = -1;
+    waiting->context = nullptr;
+    waiting->ready = nullptr;
+}
+
+// Get, set, others:
+int Session::Count() const {
+    return int(documents.size());
+}
+
+int Session::CurrentIndex() const {
+    return current;
+}
+
+const std::string &Session::CurrentPath() const {
+    return documents[current].path;
+}
+
+const std::string &Session::Path(int index) const {
+    return documents[index].path;
+}
+
+ImageEditingManager &Session::Current() {
+    return *documents[current].manager;
+}
+
+// Documents:
+bool Session::Open(int index) {
+    if (index < 0 || index >= Count()) {return false;}
+    Document &document = documents[index];
+
+    if (!document.manager) {
+        Prefetch(index);
+        cv::Mat decoded = document.decoding.get();
+        document.decoding = std::shared_future<cv::Mat>();
+        if (decoded.empty()) {
+            std::cerr << "Failed to open " << document.path << std::endl;
+            return false;
+        }
+        document.manager.reset(new ImageEditingManager(decoded, workingDepth, planar));
+    }
+
+    current = index;
+    document.lastUse = ++clock;
+    // Decode the next frame while this one is being edited
+    Prefetch(index+1);
+    Evict();
+    return true;
+}
+
+void Session::OpenLater(int index, QObject *context, std::function<void(bool)> done) {
+    if (index < 0 || index >= Count()) {return;}
+    Document &document = documents[index];
+
+    {
+        std::lock_guard<std::mutex> guard(waiting->lock);
+        waiting->index = -1;
+        waiting->ready = nullptr;
+    }
+    Prefetch(index);
+    // Already decoded (or decoding just finished): nothing to wait for
+    if (document.manager || document.decoding.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        done(Open(index));
+        return;
+    }
+
+    std::unique_lock<std::mutex> guard(waiting->lock);
+    waiting->index = index;
+    waiting->context = context;
+    waiting->ready = [this, index, done]() {done(Open(index));};
+    // The task may have finished before the request was registered
+    if (document.decoding.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        waiting->index = -1;
+        waiting->ready = nullptr;
+        guard.unlock();
+        done(Open(index));
+    }
+}
+
+void Session::Prefetch(int index) {
+    if (index < 0 || index >= Count()) {return;}
+    Document &document = documents[index];
+    if (document.manager || document.decoding.valid()) {return;}
+
+    auto decoded = std::make_shared<std::promise<cv::Mat>>();
+    std::string path = document.path;
+    std::shared_ptr<Waiting> listener = waiting;
+    document.decoding = decoded->get_future().share();
+    document.lastUse = ++clock;
+    // Ahead of queued thumbnails: the user is waiting for this one
+    pool.Submit([decoded, path, listener, index]() {
+        decoded->set_value(ReadImage(path));
+
+        std::lock_guard<std::mutex> guard(listener->lock);
+        if (listener->index == index && listener->ready) {
+            QMetaObject::invokeMethod(listener->context, listener->ready, Qt::QueuedConnection);
+            listener->index = -1;
+            listener->ready = nullptr;
+        }
+    }, true);
+}
+
+void Session::Evict() {
+    size_t resident = 0;
+    int k;
+
+    for (const Document &document : documents) {
+        if (document.manager || document.decoding.valid()) {resident++;}
+    }
+
+    while (resident > maxResident) {
+        int oldest = -1;
+        for (k=0;k<Count();k++) {
+            const Document &document = documents[k];
+            // Edits only live in memory, so edited documents are never dropped
+            bool evictable = k != current && (document.decoding.valid() ||
+                             (document.manager && !document.manager->IsEdited()));
+            if (evictable && (oldest < 0 || document.lastUse < documents[oldest].lastUse)) {
+                oldest = k;
+            }
+        }
+        if (oldest < 0) {return;}
+
+        documents[oldest].manager.reset();
+        documents[oldest].decoding = std::shared_future<cv::Mat>();
+        resident--;
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef SESSION_HPP
+#define SESSION_HPP
+
+#include <opencv2/opencv.hpp>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <QObject>
+#include "ImageEditingManager.hpp"
+#include "ThreadPool.hpp"
+
+/* Set of images opened together, each document with its own ImageEditingManager.
+Images are decoded on first use (or prefetched on the shared pool), and the least
+recently used unedited documents are dropped once more than maxResident are decoded. */
+class Session {
+
+private:
+    struct Document {
+        std::string path;
+        std::unique_ptr<ImageEditingManager> manager;
+        std::shared_future<cv::Mat> decoding;
+        size_t lastUse = 0;
+    };
+
+    // Shared with the decoding tasks, which tell the GUI thread when the awaited document is ready
+    struct Waiting {
+        std::mutex lock;
+        int index = -1;
+        QObject *context = nullptr;
+        std::function<void()> ready;
+    };
+
+    std::vector<Document> documents;
+    ThreadPool &pool;
+    size_t maxResident;
+    int workingDepth;
+    bool planar;
+    size_t clock = 0;
+    int current = -1;
+    std::shared_ptr<Waiting> waiting;
+
+    void Evict();
+
+public:
+    // Init:
+    Session(const std::vector<std::string> &paths, size_t maxResident, int workingDepth = -1, bool planar = false);
+    ~Session();
+
+    // Get, set, others:
+    int Count() const;
+    int CurrentIndex() const;
+    const std::string &CurrentPath() const;
+    const std::string &Path(int index) const;
+    ImageEditingManager &Current();
+
+    // Documents (Open returns false, keeping the current one, if the image cannot be decoded):
+    bool Open(int index);
+    /* Same without blocking: the image is decoded on the pool and done(opened) runs later
+    on the thread of context. Only the latest request is answered. */
+    void OpenLater(int index, QObject *context, std::function<void(bool)> done);
+    void Prefetch(int index);
+};
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+/* OpenCV's universal intrinsics map to SSE/AVX/NEON depending on the build.
+Every SIMD loop must keep a scalar tail (and a scalar path when CV_SIMD is 0). */
+#if CV_SIMD
+#define SIMD_U8_LANES cv::v_uint8::nlanes
+#define SIMD_U16_LANES cv::v_uint16::nlanes
+#endif
+
+// Number of row stripes for parallel reductions, a few per worker thread
+#define STRIPES_PER_THREAD 4
+
+inline int RowStripes(int rows) {
+    int stripes = cv::getNumThreads() * STRIPES_PER_THREAD;
+    if (stripes > rows) {stripes = rows;}
+    if (stripes < 1) {stripes = 1;}
+    return stripes;
+}
+
+inline cv::Range StripeRows(int stripe, int stripes, int rows) {
+    return cv::Range(stripe*rows/stripes, (stripe+1)*rows/stripes);
+}
+
+#endif
@@ -0,0 +1,63 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+
+// Background jobs mix disk reads with (reduced) decodes
+#define POOL_THREADS 4
+
+// Init:
+ThreadPool::ThreadPool(int threads) {
+    int k;
+
+    for (k=0;k<threads;k++) {
+        workers.emplace_back(&ThreadPool::Work, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    std::deque<std::function<void()>> dropped;
+
+    // Destroyed outside the lock, as they may hold anything (promises, images)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        dropped.swap(tasks);
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+ThreadPool &ThreadPool::Instance() {
+    static ThreadPool pool(std::max(1, std::min(POOL_THREADS, int(std::thread::hardware_concurrency()))));
+    return pool;
+}
+
+// Scheduling:
+void ThreadPool::Submit(std::function<void()> task, bool urgent) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (urgent) {
+            tasks.push_front(std::move(task));
+        } else {
+            tasks.push_back(std::move(task));
+        }
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::Work() {
+    while (true) {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this]() {return !tasks.empty() || stopping;});
+            if (stopping) {return;}
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+
+        task();
+    }
+}
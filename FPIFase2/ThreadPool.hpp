@@ -0,0 +1,36 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Fixed set of workers shared by every document of the session, for background
+jobs such as decoding, prefetching and thumbnails. Tasks run in submission order,
+urgent ones jump the queue. Pixel kernels keep using cv::parallel_for_, which has
+its own workers. Destruction waits for running tasks only, queued ones are dropped. */
+class ThreadPool {
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void Work();
+
+public:
+    // Init:
+    ThreadPool(int threads);
+    ~ThreadPool();
+    static ThreadPool &Instance();
+
+    // Scheduling:
+    void Submit(std::function<void()> task, bool urgent = false);
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include "ThumbnailCache.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+// EXIF and the frame header live in the first segments of a JPEG
+#define HEADER_BYTES (256*1024)
+#define DISK_QUALITY 85
+
+namespace fs = std::filesystem;
+
+// 64-bit FNV-1a, stable across runs (std::hash is not guaranteed to be)
+static uint64_t Fnv1a(const std::string &text) {
+    uint64_t hash = 14695981039346656037ull;
+
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static std::string CacheKey(const std::string &path, int maxSide) {
+    std::error_code error;
+    uintmax_t size = fs::file_size(path, error);
+    auto mtime = fs::last_write_time(path, error).time_since_epoch().count();
+    char key[17];
+
+    std::snprintf(key, sizeof(key), "%016llx", (unsigned long long)Fnv1a(
+        fs::absolute(path, error).string() + "|" + std::to_string(size) + "|" +
+        std::to_string(mtime) + "|" + std::to_string(maxSide)));
+    return key;
+}
+
+static std::string CacheFolder() {
+    const char *xdg = std::getenv("XDG_CACHE_HOME");
+    const char *home = std::getenv("HOME");
+    fs::path base = xdg && *xdg ? fs::path(xdg) : fs::path(home ? home : ".") / ".cache";
+    return (base / "DuckyShop" / "thumbnails").string();
+}
+
+// Byte readers with the TIFF byte order, bounds are checked by the callers (in size_t, by subtraction)
+static unsigned Read16(const uchar *p, bool little) {
+    return little ? p[0] | p[1] << 8 : p[0] << 8 | p[1];
+}
+
+static unsigned Read32(const uchar *p, bool little) {
+    return little ? Read16(p, true) | Read16(p+2, true) << 16 : Read16(p, false) << 16 | Read16(p+2, false);
+}
+
+/* Thumbnail stored in IFD1 of an EXIF block (TIFF data right after "Exif\0\0"),
+turned upright with the IFD0 orientation as imread does for the full image. */
+static cv::Mat ExifThumbnail(const uchar *tiff, size_t size) {
+    unsigned ifd, entries, offset = 0, length = 0, orientation = 1;
+    unsigned k;
+    cv::Mat thumbnail;
+
+    if (size < 8 || !((tiff[0] == 'I' && tiff[1] == 'I') || (tiff[0] == 'M' && tiff[1] == 'M'))) {
+        return thumbnail;
+    }
+    bool little = tiff[0] == 'I';
+
+    ifd = Read32(tiff+4, little);
+    if (ifd > size || size - ifd < 2) {return thumbnail;}
+    entries = Read16(tiff+ifd, little);
+    if (size - ifd < 2 + size_t(entries)*12 + 4) {return thumbnail;}
+    for (k=0;k<entries;k++) {
+        const uchar *entry = tiff + ifd + 2 + k*12;
+        if (Read16(entry, little) == 0x0112) {
+            orientation = Read16(entry+8, little);
+        }
+    }
+
+    ifd = Read32(tiff + ifd + 2 + entries*12, little);
+    if (ifd == 0 || ifd > size || size - ifd < 2) {return thumbnail;}
+    entries = Read16(tiff+ifd, little);
+    if (size - ifd < 2 + size_t(entries)*12) {return thumbnail;}
+    for (k=0;k<entries;k++) {
+        const uchar *entry = tiff + ifd + 2 + k*12;
+        unsigned tag = Read16(entry, little);
+        if (tag == 0x0201) {offset = Read32(entry+8, little);}
+        if (tag == 0x0202) {length = Read32(entry+8, little);}
+    }
+    if (offset == 0 || length == 0 || offset > size || size - offset < length) {return thumbnail;}
+
+    thumbnail = cv::imdecode(cv::Mat(1, length, CV_8UC1, const_cast<uchar*>(tiff+offset)), cv::IMREAD_COLOR);
+    if (thumbnail.empty()) {return thumbnail;}
+    if (orientation == 3) {
+        cv::rotate(thumbnail, thumbnail, cv::ROTATE_180);
+    } else if (orientation == 6) {
+        cv::rotate(thumbnail, thumbnail, cv::ROTATE_90_CLOCKWISE);
+    } else if (orientation == 8) {
+        cv::rotate(thumbnail, thumbnail, cv::ROTATE_90_COUNTERCLOCKWISE);
+    }
+    return thumbnail;
+}
+
+// Walks the JPEG markers up to the frame header, picking up EXIF on the way
+void ParseJpeg(const std::vector<uchar> &bytes, cv::Mat &exif, cv::Size &size) {
+    size_t pos = 2;
+
+    if (bytes.size() < 4 || bytes[0] != 0xFF || bytes[1] != 0xD8) {return;}
+    while (pos + 4 <= bytes.size() && bytes[pos] == 0xFF) {
+        unsigned marker = bytes[pos+1];
+        if (marker == 0xFF) {pos++; continue;}
+        if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {pos += 2; continue;}
+        if (marker == 0xDA || marker == 0xD9) {return;}
+
+        size_t length = Read16(&bytes[pos+2], false);
+        // The length counts its own two bytes, anything shorter is corrupt
+        if (length < 2) {return;}
+        const uchar *data = &bytes[pos+4];
+        size_t available = std::min(length - 2, bytes.size() - (pos+4));
+
+        if (marker == 0xE1 && available > 6 && std::equal(data, data+6, "Exif\0\0")) {
+            exif = ExifThumbnail(data+6, available-6);
+        }
+        // SOF0..SOF15, minus DHT, JPG and DAC
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (available >= 5) {
+                size = cv::Size(Read16(data+3, false), Read16(data+1, false));
+            }
+            return;
+        }
+        pos += 2 + length;
+    }
+}
+
+static cv::Mat FitInside(const cv::Mat &img, int maxSide) {
+    double scale = double(maxSide) / std::max(img.cols, img.rows);
+    cv::Mat fitted;
+
+    if (scale >= 1) {return img;}
+    cv::resize(img, fitted, cv::Size(std::max(1, int(img.cols*scale)), std::max(1, int(img.rows*scale))), 0, 0, cv::INTER_AREA);
+    return fitted;
+}
+
+// Init:
+ThumbnailCache::ThumbnailCache(int maxSide, size_t maxEntries):
+    state(std::make_shared<State>()), pool(ThreadPool::Instance()) {
+    std::error_code error;
+
+    state->folder = CacheFolder();
+    state->maxSide = maxSide;
+    state->maxEntries = maxEntries;
+    fs::create_directories(state->folder, error);
+}
+
+ThumbnailCache::~ThumbnailCache() {
+    std::lock_guard<std::mutex> guard(state->lock);
+    state->cancelled = true;
+}
+
+// Lookups:
+cv::Mat ThumbnailCache::Get(const std::string &path) {
+    return Load(*state, path);
+}
+
+void ThumbnailCache::Request(const std::string &path, std::function<void(const cv::Mat&)> done) {
+    std::shared_ptr<State> shared = state;
+
+    pool.Submit([shared, path, done]() {
+        {
+            std::lock_guard<std::mutex> guard(shared->lock);
+            if (shared->cancelled) {return;}
+        }
+        cv::Mat thumbnail = Load(*shared, path);
+        // Holding the lock keeps the destructor from returning while done runs
+        std::lock_guard<std::mutex> guard(shared->lock);
+        if (!shared->cancelled) {
+            done(thumbnail);
+        }
+    });
+}
+
+cv::Mat ThumbnailCache::Load(State &state, const std::string &path) {
+    std::string key = CacheKey(path, state.maxSide);
+    std::string diskPath = (fs::path(state.folder) / (key + ".jpg")).string();
+    cv::Mat thumbnail;
+
+    {
+        std::lock_guard<std::mutex> guard(state.lock);
+        auto found = state.entries.find(key);
+        if (found != state.entries.end()) {
+            state.recent.splice(state.recent.begin(), state.recent, found->second.second);
+            return found->second.first;
+        }
+    }
+
+    thumbnail = cv::imread(diskPath);
+    if (thumbnail.empty()) {
+        std::vector<uchar> header(HEADER_BYTES);
+        std::ifstream file(path, std::ios::binary);
+        cv::Size size;
+
+        file.read(reinterpret_cast<char*>(header.data()), header.size());
+        header.resize(file.gcount());
+        ParseJpeg(header, thumbnail, size);
+
+        // Embedded previews are often smaller than asked for, then decode instead
+        if (thumbnail.empty() || std::max(thumbnail.cols, thumbnail.rows) < state.maxSide) {
+            int flags = cv::IMREAD_COLOR;
+            int longest = std::max(size.width, size.height);
+            if (longest >= state.maxSide*8) {
+                flags = cv::IMREAD_REDUCED_COLOR_8;
+            } else if (longest >= state.maxSide*4) {
+                flags = cv::IMREAD_REDUCED_COLOR_4;
+            } else if (longest >= state.maxSide*2) {
+                flags = cv::IMREAD_REDUCED_COLOR_2;
+            }
+            thumbnail = cv::imread(path, flags);
+        }
+        if (thumbnail.empty()) {return thumbnail;}
+
+        thumbnail = FitInside(thumbnail, state.maxSide);
+        cv::imwrite(diskPath, thumbnail, {cv::IMWRITE_JPEG_QUALITY, DISK_QUALITY});
+    }
+
+    std::lock_guard<std::mutex> guard(state.lock);
+    if (state.entries.count(key) == 0) {
+        state.recent.push_front(key);
+        state.entries[key] = std::make_pair(thumbnail, state.recent.begin());
+        if (state.entries.size() > state.maxEntries) {
+            state.entries.erase(state.recent.back());
+            state.recent.pop_back();
+        }
+    }
+    return thumbnail;
+}
@@ -0,0 +1,52 @@
+#ifndef THUMBNAILCACHE_HPP
+#define THUMBNAILCACHE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ThreadPool.hpp"
+
+/* Small previews (longest side maxSide) for the session strip. A thumbnail comes, in
+order, from memory (LRU of maxEntries), from the disk cache (keyed by path, size and
+mtime), from the EXIF thumbnail embedded in the JPEG, or from a reduced-size decode.
+Only the last one touches the full image data, and even then at 1/2, 1/4 or 1/8. */
+class ThumbnailCache {
+
+private:
+    // Shared with queued tasks, so they can outlive the cache safely
+    struct State {
+        std::mutex lock;
+        std::list<std::string> recent;
+        std::unordered_map<std::string, std::pair<cv::Mat, std::list<std::string>::iterator>> entries;
+        std::string folder;
+        int maxSide;
+        size_t maxEntries;
+        bool cancelled = false;
+    };
+
+    std::shared_ptr<State> state;
+    ThreadPool &pool;
+
+    static cv::Mat Load(State &state, const std::string &path);
+
+public:
+    // Init:
+    ThumbnailCache(int maxSide, size_t maxEntries);
+    ~ThumbnailCache();
+
+    // Blocking lookup (empty if the file cannot be decoded):
+    cv::Mat Get(const std::string &path);
+    // Background lookup on the shared pool, done runs there and never after destruction:
+    void Request(const std::string &path, std::function<void(const cv::Mat&)> done);
+};
+
+/* Reads the markers of a JPEG header (bytes may be cut anywhere) up to the frame
+header: exif gets the embedded EXIF thumbnail, if any, and size the frame size. */
+void ParseJpeg(const std::vector<uchar> &bytes, cv::Mat &exif, cv::Size &size);
+
+#endif
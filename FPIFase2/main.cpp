@@ -5,13 +5,23 @@
 #include <QTableWidget>
 #include <QTableWidgetItem>
 #include <QPushButton>
+#include <QComboBox>
 #include <QVBoxLayout>
 #include <QSlider>
 #include <QPixmap>
+#include <QFileDialog>
+#include <QListWidget>
+#include <QIcon>
+#include <filesystem>
 #include <opencv2/opencv.hpp>
 #include "ImageEditingManager.hpp"
 #include "ImageMatrix.hpp"
 #include "Histogram.hpp"
+#include "HistogramPanel.hpp"
+#include "Session.hpp"
+#include "BatchWindow.hpp"
+#include "ThumbnailCache.hpp"
+#include "SelectionTool.hpp"
 
 #define DESCRIPTION_HEIGHT 20
 #define COMMANDS_HEIGHT 280
@@ -22,6 +32,38 @@
 #define SLIDER_WIDTH 150
 #define SLIDER_NUM_WIDTH 28
 #define SLIDER_TITLE_HEIGHT 15
+#define PROFILE_WIDTH 420
+#define PROFILE_HEIGHT 300
+#define LIVE_HISTOGRAM_HEIGHT 140
+#define LIVE_PROXY_PIXELS 65536
+#define SESSION_MAX_RESIDENT 8
+/* Depth edits are kept at, unless --depth gives another: -1 keeps the depth each image
+decodes to, CV_8U, CV_16U or CV_32F convert to it. Either way edits are only rounded to
+8-bit for display and saving, and float takes four times the memory of 8-bit. */
+#define WORKING_DEPTH -1
+// Keeps each colour in its own plane while editing, interleaving only for display and saving
+#define PLANAR_LAYOUT false
+// Canny hysteresis thresholds, as fractions of a full step edge
+#define CANNY_LOW 0.1
+#define CANNY_HIGH 0.3
+#define MEDIAN_LARGE_RADIUS 7
+// Bilateral sigmas: pixels, and fraction of full scale
+#define BILATERAL_SPATIAL 16
+#define BILATERAL_RANGE 0.1
+// Gaussian blur sigma slider, in tenths of a pixel
+#define SIGMA_SLIDER_MIN 5
+#define SIGMA_SLIDER_MAX 500
+#define SIGMA_SLIDER_DEFAULT 30
+// Unsharp mask strength slider, in hundredths
+#define AMOUNT_SLIDER_MAX 300
+#define AMOUNT_SLIDER_DEFAULT 100
+// Smallest luma detail the unsharp mask sharpens, in 8-bit levels
+#define THRESHOLD_SLIDER_MAX 64
+#define THRESHOLD_SLIDER_DEFAULT 5
+#define THUMBNAIL_SIDE 128
+#define THUMBNAIL_ENTRIES 512
+#define STRIP_WIDTH 800
+#define STRIP_HEIGHT 190
 #define SPACE 5
 
 #define IMG_AREA_START  COMMANDS_WIDTH
@@ -30,20 +72,44 @@
 #define SLIDER_ABOVE    SLIDER_TITLE_HEIGHT+SLIDER_HEIGHT+SPACE*2
 
 
+// Value of --depth=native|8|16|float, false if it is none of them
+static bool ParseDepth(const std::string &value, int &depth) {
+    if (value == "native") {depth = -1;}
+    else if (value == "8") {depth = CV_8U;}
+    else if (value == "16") {depth = CV_16U;}
+    else if (value == "float") {depth = CV_32F;}
+    else return false;
+    return true;
+}
+
 int main(int argc, char *argv[]) {
 
     // 0. GET IMAGE
 
-    // 0.1 Check provided parameters
-    if (argc < 2) {
+    // 0.1 Check provided parameters, options come before the images
+    const std::string depthOption = "--depth=";
+    int workingDepth = WORKING_DEPTH;
+    int firstPath = 1;
+    for (;firstPath<argc && std::string(argv[firstPath]).rfind(depthOption, 0) == 0;firstPath++) {
+        if (!ParseDepth(std::string(argv[firstPath]).substr(depthOption.size()), workingDepth)) {
+            std::cerr << "ERROR: unknown working depth " << argv[firstPath] << std::endl;
+            return -1;
+        }
+    }
+    if (firstPath >= argc) {
         std::cerr << "ERROR: you must provide image path!" << std::endl;
-        std::cerr << "Usage example: " << argv[0] << " <caminho_da_imagem>" << std::endl;
+        std::cerr << "Usage example: " << argv[0] << " [--depth=native|8|16|float] <caminho_da_imagem> [<outras_imagens>...]" << std::endl;
         return -1;
     }
 
-    // 0.2 Open main image
-    cv::Mat mainImg = cv::imread(argv[1]);
-    if (mainImg.empty()) {
+    // 0.2 Inicialize Qt application and window before the session: documents hold pixmaps and
+    // decodes notify the window, and the session, declared later, is destroyed before both
+    QApplication app(argc, argv);
+    QWidget window;
+
+    // 0.3 Open session, only the first image is decoded now (the next one is prefetched)
+    Session session(std::vector<std::string>(argv+firstPath, argv+argc), SESSION_MAX_RESIDENT, workingDepth, PLANAR_LAYOUT);
+    if (!session.Open(0)) {
         std::cout << "Failed to open image!" << std::endl;
         return -1;
     }
@@ -51,48 +117,34 @@ int main(int argc, char *argv[]) {
 
     // 1. INICIAL SETTINGS
     
-    // 1.1 Set current image (editing variable) and buffer for quantization
-    cv::Mat currentImg = mainImg;
-    cv::Mat quantBuffer = currentImg;
-    ImageEditingManager img(mainImg);
+    // 1.1 Set current image size
+    cv::Size mainSize = session.Current().GetOriginalSize();
 
     // 1.2 Set window inicial sizes based on chosen image
-    int windowWidth = COMMANDS_WIDTH + mainImg.cols*2 + SPACE*2;
-    int windowHeight = DESCRIPTION_HEIGHT + mainImg.rows + SPACE*3;
+    int windowWidth = COMMANDS_WIDTH + mainSize.width*2 + SPACE*2;
+    int windowHeight = DESCRIPTION_HEIGHT + mainSize.height + SPACE*3;
 
 
     // 2. APPLICATION AND IMAGES SETUP
 
-    // 2.1 Inicialize Qt application
-    QApplication app(argc, argv);
-
-    // 2.2 Inicialize application window and labels
-    QWidget window;
+    // 2.1 Set up application window and labels
     window.setWindowTitle("Ducky Shop");
     window.setFixedSize(windowWidth, windowHeight);
 
     QLabel *originalImg = new QLabel(&window);
     QLabel *editingImg = new QLabel(&window);
 
-    // 2.3 Set images position to the rigth
-    originalImg->setGeometry(IMG_AREA_START, TITLE_ABOVE, mainImg.cols, mainImg.rows);
-    editingImg->setGeometry(IMG_AREA_START+mainImg.cols+SPACE, TITLE_ABOVE, mainImg.cols, mainImg.rows);
+    // 2.2 Set images position to the rigth (images are shown once the document is attached, see 7.7)
+    originalImg->setGeometry(IMG_AREA_START, TITLE_ABOVE, mainSize.width, mainSize.height);
+    editingImg->setGeometry(IMG_AREA_START+mainSize.width+SPACE, TITLE_ABOVE, mainSize.width, mainSize.height);
 
-    // 2.4 Show original image and set correct label for editing image
-    img.SetWindow(&window);
-    img.SetImgLabel(originalImg);
-    img.ShowImage();
-    img.SetImgLabel(editingImg);
-    img.ShowImage();
-
-    // 2.5 Prepare images descriptions
+    // 2.3 Prepare images descriptions
     QLabel *title1 = new QLabel("<h3>Original</h3>", &window);
-    title1->setGeometry(IMG_AREA_START, SPACE, mainImg.cols, DESCRIPTION_HEIGHT);
+    title1->setGeometry(IMG_AREA_START, SPACE, mainSize.width, DESCRIPTION_HEIGHT);
     title1->setAlignment(Qt::AlignCenter);
     QLabel *title2 = new QLabel("<h3>Editing</h3>", &window);
-    title2->setGeometry(IMG_AREA_START+mainImg.cols+SPACE, SPACE, mainImg.cols, DESCRIPTION_HEIGHT);
+    title2->setGeometry(IMG_AREA_START+mainSize.width+SPACE, SPACE, mainSize.width, DESCRIPTION_HEIGHT);
     title2->setAlignment(Qt::AlignCenter);
-    img.SetTitleLabel(title2);
 
 
     // 3. OPERATION BUTTONS SETUP
@@ -114,56 +166,56 @@ int main(int argc, char *argv[]) {
     // 3.2 Button to mirror horizontally:
     QPushButton *btnMirrorH = new QPushButton("Mirror horizontally", &window);
     btnMirrorH->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnMirrorH, &QPushButton::clicked, [&img]() {
-        img.MirrorHorizontally();
+    QObject::connect(btnMirrorH, &QPushButton::clicked, [&session]() {
+        session.Current().MirrorHorizontally();
     });
     currentHeight += BTN_ABOVE;
 
     // 3.3 Button to mirror vertically:
     QPushButton *btnMirrorV = new QPushButton("Mirror vertically", &window);
     btnMirrorV->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnMirrorV, &QPushButton::clicked, [&img]() {
-        img.MirrorVertically();
+    QObject::connect(btnMirrorV, &QPushButton::clicked, [&session]() {
+        session.Current().MirrorVertically();
     });
     currentHeight += BTN_ABOVE;
 
     // 3.4 Button to turn to greyscale:
     QPushButton *btnGrey = new QPushButton("Greyscale", &window);
     btnGrey->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnGrey, &QPushButton::clicked, [&img]() {
-        img.ConvertGreyscale();
+    QObject::connect(btnGrey, &QPushButton::clicked, [&session]() {
+        session.Current().ConvertGreyscale();
     });
     currentHeight += BTN_ABOVE;
 
     // 3.5 Button to turn to negative:
     QPushButton *btnNeg = new QPushButton("Negative", &window);
     btnNeg->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnNeg, &QPushButton::clicked, [&img]() {
-        img.ConvertNegative();
+    QObject::connect(btnNeg, &QPushButton::clicked, [&session]() {
+        session.Current().ConvertNegative();
     });
     currentHeight += BTN_ABOVE;
 
     // 3.6 Button to zoom in:
     QPushButton *btnZoomIn = new QPushButton("Zoom in", &window);
     btnZoomIn->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnZoomIn, &QPushButton::clicked, [&img]() {
-        img.ZoomIn();
+    QObject::connect(btnZoomIn, &QPushButton::clicked, [&session]() {
+        session.Current().ZoomIn();
     });
     currentHeight += BTN_ABOVE;
 
     // 3.7 Button to zoom out:
     QPushButton *btnZoomOut = new QPushButton("Zoom out", &window);
     btnZoomOut->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnZoomOut, &QPushButton::clicked, [&img]() {
-        img.ZoomOut(2,2);
+    QObject::connect(btnZoomOut, &QPushButton::clicked, [&session]() {
+        session.Current().ZoomOut(2,2);
     });
     currentHeight += BTN_ABOVE;
 
     // 3.8 Button to rotate:
     QPushButton *btnRotate = new QPushButton("Rotate", &window);
     btnRotate->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnRotate, &QPushButton::clicked, [&img]() {
-        img.Rotate();
+    QObject::connect(btnRotate, &QPushButton::clicked, [&session]() {
+        session.Current().Rotate();
     });
     currentHeight += BTN_ABOVE;
     currentHeight += SPACE;
@@ -185,73 +237,82 @@ int main(int argc, char *argv[]) {
     title4->setFont(font);
     currentHeight += TITLE_ABOVE;
 
-    // 4.2 Button to apply gaussian filter:
+    // 4.2 How filters read past the image edges:
+    QComboBox *borderModes = new QComboBox(&window);
+    borderModes->addItem("Border: replicate", QVariant(cv::BORDER_REPLICATE));
+    borderModes->addItem("Border: reflect", QVariant(cv::BORDER_REFLECT_101));
+    borderModes->addItem("Border: wrap", QVariant(cv::BORDER_WRAP));
+    borderModes->addItem("Border: constant", QVariant(cv::BORDER_CONSTANT));
+    borderModes->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
+    currentHeight += BTN_ABOVE;
+
+    // 4.3 Button to apply gaussian filter:
     QPushButton *btnGaussian = new QPushButton("Gaussian", &window);
     btnGaussian->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnGaussian, &QPushButton::clicked, [&img]() {
+    QObject::connect(btnGaussian, &QPushButton::clicked, [&session, borderModes]() {
         double kernel[3][3] = {{0.0625, 0.125, 0.0625}, {0.125, 0.25, 0.125} , {0.0625, 0.125, 0.0625}};
-        img.ApplyFilter(kernel, false);
+        session.Current().ApplyFilter(kernel, false, borderModes->currentData().toInt());
     });
     currentHeight += BTN_ABOVE;
 
-    // 4.3 Button to apply laplacian filter:
+    // 4.4 Button to apply laplacian filter:
     QPushButton *btnLaplacian = new QPushButton("Laplacian", &window);
     btnLaplacian->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnLaplacian, &QPushButton::clicked, [&img]() {
+    QObject::connect(btnLaplacian, &QPushButton::clicked, [&session, borderModes]() {
         double kernel[3][3] = {{0, -1, 0}, {-1, 4, -1}, {0, -1, 0}};
-        img.ApplyFilter(kernel, false);
+        session.Current().ApplyFilter(kernel, false, borderModes->currentData().toInt());
     });
     currentHeight += BTN_ABOVE;
 
-    // 4.4 Button to apply high-pass filter:
+    // 4.5 Button to apply high-pass filter:
     QPushButton *btnHP = new QPushButton("High-Pass", &window);
     btnHP->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnHP, &QPushButton::clicked, [&img]() {
+    QObject::connect(btnHP, &QPushButton::clicked, [&session, borderModes]() {
         double kernel[3][3] = {{-1, -1, -1}, {-1, 8, -1}, {-1, -1, -1}};
-        img.ApplyFilter(kernel, false);
+        session.Current().ApplyFilter(kernel, false, borderModes->currentData().toInt());
     });
     currentHeight += BTN_ABOVE;
 
-    // 4.5 Button to apply horizontal Prewitt filter:
+    // 4.6 Button to apply horizontal Prewitt filter:
     QPushButton *btnPrewittH = new QPushButton("Prewitt Horizontal", &window);
     btnPrewittH->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnPrewittH, &QPushButton::clicked, [&img]() {
+    QObject::connect(btnPrewittH, &QPushButton::clicked, [&session, borderModes]() {
         double kernel[3][3] = {{-1, 0, 1}, {-1, 0, 1}, {-1, 0, 1}};
-        img.ApplyFilter(kernel, true);
+        session.Current().ApplyFilter(kernel, true, borderModes->currentData().toInt());
     });
     currentHeight += BTN_ABOVE;
 
-    // 4.6 Button to apply vertical Prewitt filter:
+    // 4.7 Button to apply vertical Prewitt filter:
     QPushButton *btnPrewittV = new QPushButton("Prewitt Vertical", &window);
     btnPrewittV->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnPrewittV, &QPushButton::clicked, [&img]() {
+    QObject::connect(btnPrewittV, &QPushButton::clicked, [&session, borderModes]() {
         double kernel[3][3] = {{-1, -1, -1}, {0, 0, 0}, {1, 1, 1}};
-        img.ApplyFilter(kernel, true);
+        session.Current().ApplyFilter(kernel, true, borderModes->currentData().toInt());
     });
     currentHeight += BTN_ABOVE;
 
-    // 4.7 Button to apply horizontal Sobel filter:
+    // 4.8 Button to apply horizontal Sobel filter:
     QPushButton *btnSobelH = new QPushButton("Sobel Horizontal", &window);
     btnSobelH->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnSobelH, &QPushButton::clicked, [&img]() {
+    QObject::connect(btnSobelH, &QPushButton::clicked, [&session, borderModes]() {
         double kernel[3][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
-        img.ApplyFilter(kernel, true);
+        session.Current().ApplyFilter(kernel, true, borderModes->currentData().toInt());
     });
     currentHeight += BTN_ABOVE;
 
-    // 4.8 Button to apply vertical Sobel filter:
+    // 4.9 Button to apply vertical Sobel filter:
     QPushButton *btnSobelV = new QPushButton("Sobel Vertical", &window);
     btnSobelV->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnSobelV, &QPushButton::clicked, [&img]() {
+    QObject::connect(btnSobelV, &QPushButton::clicked, [&session, borderModes]() {
         double kernel[3][3] = {{-1, -2, -1}, {0, 0, 0}, {1, 2, 1}};
-        img.ApplyFilter(kernel, true);
+        session.Current().ApplyFilter(kernel, true, borderModes->currentData().toInt());
     });
     currentHeight += BTN_ABOVE;
 
-    // 4.9 Button to set personalized filter:
+    // 4.10 Button to set personalized filter:
     QPushButton *btnPersonalized = new QPushButton("Personalized", &window);
     btnPersonalized->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnPersonalized, &QPushButton::clicked, [&img]() {
+    QObject::connect(btnPersonalized, &QPushButton::clicked, [&session, borderModes]() {
 
         // Open new window for setting kernel matrix
         QWidget *matrixWindow = new QWidget;
@@ -265,7 +326,7 @@ int main(int argc, char *argv[]) {
 
         // Button to apply new kernel
         QPushButton *btnApply = new QPushButton("Apply filter");
-        QObject::connect(btnApply, &QPushButton::clicked, [&img, matrix]() {
+        QObject::connect(btnApply, &QPushButton::clicked, [&session, matrix, borderModes]() {
             double kernel[3][3];
             for (int i=0;i<3;++i) {
                 for (int j=0;j<3;++j) {
@@ -277,7 +338,7 @@ int main(int argc, char *argv[]) {
                     }
                 }
             }
-            img.ApplyFilter(kernel, false);
+            session.Current().ApplyFilter(kernel, false, borderModes->currentData().toInt());
         });
 
         // Launch new window
@@ -291,9 +352,122 @@ int main(int argc, char *argv[]) {
 
     });
     currentHeight += BTN_ABOVE;
+
+    // 4.11 Button to apply Sobel gradient magnitude, both directions in one pass:
+    QPushButton *btnSobelMag = new QPushButton("Sobel magnitude", &window);
+    btnSobelMag->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
+    QObject::connect(btnSobelMag, &QPushButton::clicked, [&session, borderModes]() {
+        session.Current().ApplyGradient(2, true, borderModes->currentData().toInt());
+    });
+    currentHeight += BTN_ABOVE;
+
+    // 4.12 Button to apply Prewitt gradient magnitude:
+    QPushButton *btnPrewittMag = new QPushButton("Prewitt magnitude", &window);
+    btnPrewittMag->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
+    QObject::connect(btnPrewittMag, &QPushButton::clicked, [&session, borderModes]() {
+        session.Current().ApplyGradient(1, true, borderModes->currentData().toInt());
+    });
+    currentHeight += BTN_ABOVE;
+
+    // 4.13 Button to detect Canny edges:
+    QPushButton *btnCanny = new QPushButton("Canny edges", &window);
+    btnCanny->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
+    QObject::connect(btnCanny, &QPushButton::clicked, [&session, borderModes]() {
+        session.Current().ApplyCanny(CANNY_LOW, CANNY_HIGH, borderModes->currentData().toInt());
+    });
+    currentHeight += BTN_ABOVE;
+
+    // 4.14 Buttons to apply median filters, small to large:
+    QPushButton *btnMedian3 = new QPushButton("Median 3", &window);
+    btnMedian3->setGeometry(SPACE, currentHeight, BTN_WIDTH/3-SPACE/2, BTN_HEIGHT);
+    QObject::connect(btnMedian3, &QPushButton::clicked, [&session, borderModes]() {
+        session.Current().ApplyMedian(1, borderModes->currentData().toInt());
+    });
+    QPushButton *btnMedian5 = new QPushButton("Median 5", &window);
+    btnMedian5->setGeometry(SPACE+BTN_WIDTH/3, currentHeight, BTN_WIDTH/3-SPACE/2, BTN_HEIGHT);
+    QObject::connect(btnMedian5, &QPushButton::clicked, [&session, borderModes]() {
+        session.Current().ApplyMedian(2, borderModes->currentData().toInt());
+    });
+    QPushButton *btnMedianLarge = new QPushButton(QString("Median %1").arg(MEDIAN_LARGE_RADIUS*2+1), &window);
+    btnMedianLarge->setGeometry(SPACE+2*(BTN_WIDTH/3), currentHeight, BTN_WIDTH-2*(BTN_WIDTH/3), BTN_HEIGHT);
+    QObject::connect(btnMedianLarge, &QPushButton::clicked, [&session, borderModes]() {
+        session.Current().ApplyMedian(MEDIAN_LARGE_RADIUS, borderModes->currentData().toInt());
+    });
+    currentHeight += BTN_ABOVE;
+
+    // 4.15 Button to apply edge-preserving bilateral smoothing:
+    QPushButton *btnBilateral = new QPushButton("Bilateral", &window);
+    btnBilateral->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
+    QObject::connect(btnBilateral, &QPushButton::clicked, [&session]() {
+        session.Current().ApplyBilateral(BILATERAL_SPATIAL, BILATERAL_RANGE);
+    });
+    currentHeight += BTN_ABOVE;
+
+    // 4.16 Gaussian blur of any strength, the slider sets sigma in tenths of a pixel:
+    QLabel *titleSigma = new QLabel("Blur sigma:", &window);
+    titleSigma->setGeometry(SPACE, currentHeight, BTN_WIDTH, SLIDER_TITLE_HEIGHT);
+    titleSigma->setAlignment(Qt::AlignCenter);
+    currentHeight += SLIDER_TITLE_HEIGHT;
+    QSlider *sliderSigma = new QSlider(Qt::Horizontal, &window);
+    sliderSigma->setRange(SIGMA_SLIDER_MIN, SIGMA_SLIDER_MAX);
+    sliderSigma->setValue(SIGMA_SLIDER_DEFAULT);
+    sliderSigma->setGeometry(SPACE, currentHeight, SLIDER_WIDTH, SLIDER_HEIGHT);
+    QLabel *numSigma = new QLabel(QString::number(sliderSigma->value() / 10.0, 'f', 1), &window);
+    numSigma->setGeometry(SLIDER_WIDTH+SPACE, currentHeight, SLIDER_NUM_WIDTH, SLIDER_HEIGHT);
+    numSigma->setAlignment(Qt::AlignCenter);
+    QObject::connect(sliderSigma, &QSlider::valueChanged, [numSigma](int value) {
+        numSigma->setText(QString::number(value / 10.0, 'f', 1));
+    });
+    currentHeight += SLIDER_HEIGHT+SPACE;
+    QPushButton *btnBlur = new QPushButton("Gaussian blur", &window);
+    btnBlur->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
+    QObject::connect(btnBlur, &QPushButton::clicked, [&session, sliderSigma, borderModes]() {
+        session.Current().ApplyGaussian(sliderSigma->value() / 10.0, borderModes->currentData().toInt());
+    });
+    currentHeight += BTN_ABOVE;
+
+    // 4.17 Unsharp mask, its radius being the blur sigma above; amount in hundredths, threshold in 8-bit levels:
+    QLabel *titleAmount = new QLabel("Sharpen amount:", &window);
+    titleAmount->setGeometry(SPACE, currentHeight, BTN_WIDTH, SLIDER_TITLE_HEIGHT);
+    titleAmount->setAlignment(Qt::AlignCenter);
+    currentHeight += SLIDER_TITLE_HEIGHT;
+    QSlider *sliderAmount = new QSlider(Qt::Horizontal, &window);
+    sliderAmount->setRange(0, AMOUNT_SLIDER_MAX);
+    sliderAmount->setValue(AMOUNT_SLIDER_DEFAULT);
+    sliderAmount->setGeometry(SPACE, currentHeight, SLIDER_WIDTH, SLIDER_HEIGHT);
+    QLabel *numAmount = new QLabel(QString::number(sliderAmount->value() / 100.0, 'f', 2), &window);
+    numAmount->setGeometry(SLIDER_WIDTH+SPACE, currentHeight, SLIDER_NUM_WIDTH, SLIDER_HEIGHT);
+    numAmount->setAlignment(Qt::AlignCenter);
+    QObject::connect(sliderAmount, &QSlider::valueChanged, [numAmount](int value) {
+        numAmount->setText(QString::number(value / 100.0, 'f', 2));
+    });
+    currentHeight += SLIDER_HEIGHT+SPACE;
+    QLabel *titleThreshold = new QLabel("Sharpen threshold:", &window);
+    titleThreshold->setGeometry(SPACE, currentHeight, BTN_WIDTH, SLIDER_TITLE_HEIGHT);
+    titleThreshold->setAlignment(Qt::AlignCenter);
+    currentHeight += SLIDER_TITLE_HEIGHT;
+    QSlider *sliderThreshold = new QSlider(Qt::Horizontal, &window);
+    sliderThreshold->setRange(0, THRESHOLD_SLIDER_MAX);
+    sliderThreshold->setValue(THRESHOLD_SLIDER_DEFAULT);
+    sliderThreshold->setGeometry(SPACE, currentHeight, SLIDER_WIDTH, SLIDER_HEIGHT);
+    QLabel *numThreshold = new QLabel(QString::number(sliderThreshold->value()), &window);
+    numThreshold->setGeometry(SLIDER_WIDTH+SPACE, currentHeight, SLIDER_NUM_WIDTH, SLIDER_HEIGHT);
+    numThreshold->setAlignment(Qt::AlignCenter);
+    QObject::connect(sliderThreshold, &QSlider::valueChanged, [numThreshold](int value) {
+        numThreshold->setText(QString::number(value));
+    });
+    currentHeight += SLIDER_HEIGHT+SPACE;
+    QPushButton *btnUnsharp = new QPushButton("Unsharp mask", &window);
+    btnUnsharp->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
+    QObject::connect(btnUnsharp, &QPushButton::clicked,
+                     [&session, sliderAmount, sliderSigma, sliderThreshold, borderModes]() {
+        session.Current().ApplyUnsharp(sliderAmount->value() / 100.0, sliderSigma->value() / 10.0,
+                                       sliderThreshold->value() / 255.0, borderModes->currentData().toInt());
+    });
+    currentHeight += BTN_ABOVE;
     currentHeight += SPACE;
 
-    // 4.10 Separation line
+    // 4.18 Separation line
     QFrame *line2 = new QFrame(&window);
     line2->setFrameShape(QFrame::HLine);
     line2->setFrameShadow(QFrame::Sunken); 
@@ -309,37 +483,48 @@ int main(int argc, char *argv[]) {
     title5->setAlignment(Qt::AlignCenter);
     title5->setFont(font);
     currentHeight += TITLE_ABOVE;
+
+    // Single histogram window, reused by every histogram operation
+    HistogramPanel histogramPanel;
     
     // 5.2 Button to show histogram:
-    QPushButton *btnHist = new QPushButton("Show grey histogram", &window);
+    QPushButton *btnHist = new QPushButton("Show histogram", &window);
     btnHist->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnHist, &QPushButton::clicked, [&img]() {
-        img.ShowHistogram();
+    QObject::connect(btnHist, &QPushButton::clicked, [&session]() {
+        session.Current().ShowHistogram();
     });
     currentHeight += BTN_ABOVE;
 
     // 5.3 Button to equalize histogram:
     QPushButton *btnEqual = new QPushButton("Equalize histogram", &window);
     btnEqual->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnEqual, &QPushButton::clicked, [&img]() {
-        img.EqualizeImgHistogram();
+    QObject::connect(btnEqual, &QPushButton::clicked, [&session]() {
+        session.Current().EqualizeImgHistogram();
     });
     currentHeight += BTN_ABOVE;
 
     // 5.4 Button to better equalize colored images:
     QPushButton *btnLab = new QPushButton("L*a*b* equalization", &window);
     btnLab->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnLab, &QPushButton::clicked, [&img]() {
-        if (img.GetGreyFlag()) {
-            img.EqualizeImgHistogram();
+    QObject::connect(btnLab, &QPushButton::clicked, [&session]() {
+        if (session.Current().GetGreyFlag()) {
+            session.Current().EqualizeImgHistogram();
         } else {
-            img.EqualizeTroughLAB();
+            session.Current().EqualizeTroughLAB();
         }
     });
     currentHeight += BTN_ABOVE;
+
+    // 5.5 Button for contrast-limited adaptive equalization:
+    QPushButton *btnAdaptive = new QPushButton("Adaptive equalization", &window);
+    btnAdaptive->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
+    QObject::connect(btnAdaptive, &QPushButton::clicked, [&session]() {
+        session.Current().EqualizeAdaptive();
+    });
+    currentHeight += BTN_ABOVE;
     currentHeight += SPACE;
 
-    // 5.5 Separation line
+    // 5.6 Separation line
     QFrame *line3 = new QFrame(&window);
     line3->setFrameShape(QFrame::HLine);
     line3->setFrameShadow(QFrame::Sunken); 
@@ -367,8 +552,9 @@ int main(int argc, char *argv[]) {
     sliderQtz->setRange(1, 256);
     sliderQtz->setValue(265);
     sliderQtz->setGeometry(SPACE, currentHeight, SLIDER_WIDTH, SLIDER_HEIGHT);
-    QObject::connect(sliderQtz, &QSlider::sliderReleased, [&img, sliderQtz]() {
-        img.AdjustQuantization(sliderQtz->value());
+    // Applied while dragging: the live histogram only counts the latest frame
+    QObject::connect(sliderQtz, &QSlider::valueChanged, [&session](int value) {
+        session.Current().AdjustQuantization(value);
     });
     // Label to show slider value:
     QLabel *num1 = new QLabel(QString::number(sliderQtz->value()), &window);
@@ -390,8 +576,8 @@ int main(int argc, char *argv[]) {
     sliderBright->setRange(-255, 255);
     sliderBright->setValue(0);
     sliderBright->setGeometry(SPACE, currentHeight, SLIDER_WIDTH, SLIDER_HEIGHT);
-    QObject::connect(sliderBright, &QSlider::sliderReleased, [&img, sliderBright]() {
-        img.AdjustBrightness(sliderBright->value());
+    QObject::connect(sliderBright, &QSlider::valueChanged, [&session](int value) {
+        session.Current().AdjustBrightness(value);
     });
     // Label to show slider value:
     QLabel *num2 = new QLabel(QString::number(sliderBright->value()), &window);
@@ -423,9 +609,9 @@ int main(int argc, char *argv[]) {
             return 2.0f + ((sliderValue - 200) / 55.0f) * 254.0f;
         }
     };
-    QObject::connect(sliderCont, &QSlider::sliderReleased, [&img, sliderCont, mapSliderValue]() {
-        float contrastValue = mapSliderValue(sliderCont->value());
-        img.AdjustContrast(contrastValue);
+    QObject::connect(sliderCont, &QSlider::valueChanged, [&session, mapSliderValue](int value) {
+        float contrastValue = mapSliderValue(value);
+        session.Current().AdjustContrast(contrastValue);
     });
     // Label to show slider value:
     QLabel *num3 = new QLabel(QString::number(mapSliderValue(sliderCont->value()), 'f', 2), &window);
@@ -454,28 +640,183 @@ int main(int argc, char *argv[]) {
     // 7.1 Button for reseting current image:
     QPushButton *btnReset = new QPushButton("Reset", &window);
     btnReset->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnReset, &QPushButton::clicked, [&img]() {
-        img.Reset();
+    QObject::connect(btnReset, &QPushButton::clicked, [&session]() {
+        session.Current().Reset();
     });
     currentHeight += BTN_ABOVE;
 
     // 7.2 Button for saving current image as JPEG file:
     QPushButton *btnSave = new QPushButton("Save as JPEG", &window);
     btnSave->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
-    QObject::connect(btnSave, &QPushButton::clicked, [&img]() {
-        img.Save();
+    QObject::connect(btnSave, &QPushButton::clicked, [&session]() {
+        session.Current().Save();
+    });
+    currentHeight += BTN_ABOVE;
+
+    // 7.3 Profiling overlay, hidden until requested:
+    QLabel *profilePanel = new QLabel(&window);
+    QFont monoFont("Monospace");
+    monoFont.setStyleHint(QFont::TypeWriter);
+    monoFont.setPointSize(8);
+    profilePanel->setFont(monoFont);
+    profilePanel->setAlignment(Qt::AlignLeft | Qt::AlignTop);
+    profilePanel->setStyleSheet("background-color: rgba(0, 0, 0, 170); color: white; padding: 4px;");
+    profilePanel->setGeometry(IMG_AREA_START+mainSize.width+SPACE, TITLE_ABOVE, PROFILE_WIDTH, PROFILE_HEIGHT);
+    profilePanel->hide();
+
+    // 7.4 Button for showing/hiding the profiling overlay:
+    QPushButton *btnProfile = new QPushButton("Profiling panel", &window);
+    btnProfile->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
+    QObject::connect(btnProfile, &QPushButton::clicked, [&session]() {
+        session.Current().ToggleProfilePanel();
+    });
+    currentHeight += BTN_ABOVE;
+
+    // 7.5 Button for exporting the profiling session as a Chrome trace:
+    QPushButton *btnTrace = new QPushButton("Export trace", &window);
+    btnTrace->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
+    QObject::connect(btnTrace, &QPushButton::clicked, [&session]() {
+        session.Current().ExportTrace();
+    });
+    currentHeight += BTN_ABOVE;
+
+    // 7.6 Live histogram docked under the commands, refreshed after every edit:
+    HistogramPanel *liveHistogram = new HistogramPanel(&window, LIVE_PROXY_PIXELS);
+    liveHistogram->setGeometry(SPACE, currentHeight, BTN_WIDTH, LIVE_HISTOGRAM_HEIGHT);
+    currentHeight += LIVE_HISTOGRAM_HEIGHT+SPACE;
+
+    // 7.7 Thumbnail strip of the session images, filled in the background (declared
+    // before the cache, so the cache stops posting to it before it goes away):
+    QListWidget strip;
+    ThumbnailCache thumbnails(THUMBNAIL_SIDE, THUMBNAIL_ENTRIES);
+    strip.setWindowTitle("Session");
+    strip.setViewMode(QListView::IconMode);
+    strip.setFlow(QListView::LeftToRight);
+    strip.setWrapping(false);
+    strip.setMovement(QListView::Static);
+    strip.setIconSize(QSize(THUMBNAIL_SIDE, THUMBNAIL_SIDE));
+    strip.resize(STRIP_WIDTH, STRIP_HEIGHT);
+    for (int k=0;k<session.Count();k++) {
+        std::string name = std::filesystem::path(session.Path(k)).filename().string();
+        new QListWidgetItem(QString::fromStdString(name), &strip);
+        thumbnails.Request(session.Path(k), [&strip, k](const cv::Mat &thumbnail) {
+            if (thumbnail.empty()) {return;}
+            QImage icon = QImage(thumbnail.data, thumbnail.cols, thumbnail.rows, thumbnail.step, QImage::Format_RGB888).rgbSwapped();
+            QMetaObject::invokeMethod(&strip, [&strip, k, icon]() {
+                strip.item(k)->setIcon(QIcon(QPixmap::fromImage(icon)));
+            }, Qt::QueuedConnection);
+        });
+    }
+
+    // 7.8 Selection drawn over the edited image, operations then apply inside it:
+    SelectionTool *selectionTool = new SelectionTool(editingImg);
+    selectionTool->SetCallback([&session](cv::Rect region, const cv::Mat &mask) {
+        session.Current().SetSelection(region, mask);
+    });
+    QPushButton *btnRectSelect = new QPushButton("Rectangle", &window);
+    btnRectSelect->setGeometry(SPACE, currentHeight, BTN_WIDTH/3-SPACE/2, BTN_HEIGHT);
+    QObject::connect(btnRectSelect, &QPushButton::clicked, [selectionTool]() {
+        selectionTool->SetMode(SelectionTool::Rectangle);
+    });
+    QPushButton *btnLassoSelect = new QPushButton("Lasso", &window);
+    btnLassoSelect->setGeometry(SPACE+BTN_WIDTH/3, currentHeight, BTN_WIDTH/3-SPACE/2, BTN_HEIGHT);
+    QObject::connect(btnLassoSelect, &QPushButton::clicked, [selectionTool]() {
+        selectionTool->SetMode(SelectionTool::Lasso);
+    });
+    QPushButton *btnClearSelect = new QPushButton("Select all", &window);
+    btnClearSelect->setGeometry(SPACE+2*(BTN_WIDTH/3), currentHeight, BTN_WIDTH-2*(BTN_WIDTH/3), BTN_HEIGHT);
+    QObject::connect(btnClearSelect, &QPushButton::clicked, [&session, selectionTool]() {
+        selectionTool->SetMode(SelectionTool::None);
+        session.Current().ClearSelection();
+    });
+    currentHeight += BTN_ABOVE;
+
+    // 7.9 Attach the current document to the window, sized after its original image
+    auto showDocument = [&]() {
+        ImageEditingManager &doc = session.Current();
+        cv::Size size = doc.GetOriginalSize();
+
+        originalImg->setGeometry(IMG_AREA_START, TITLE_ABOVE, size.width, size.height);
+        editingImg->setGeometry(IMG_AREA_START+size.width+SPACE, TITLE_ABOVE, size.width, size.height);
+        title1->setGeometry(IMG_AREA_START, SPACE, size.width, DESCRIPTION_HEIGHT);
+        title2->setGeometry(IMG_AREA_START+size.width+SPACE, SPACE, size.width, DESCRIPTION_HEIGHT);
+        profilePanel->move(IMG_AREA_START+size.width+SPACE, TITLE_ABOVE);
+        window.setFixedSize(COMMANDS_WIDTH + size.width*2 + SPACE*2, window.height());
+
+        doc.SetWindow(&window);
+        doc.ShowOriginal(originalImg);
+        doc.SetImgLabel(editingImg);
+        doc.SetTitleLabel(title2);
+        doc.SetMinHeight(currentHeight+SPACE);
+        doc.SetProfileLabel(profilePanel);
+        doc.SetHistogramPanel(&histogramPanel);
+        doc.SetLiveHistogram(liveHistogram);
+        doc.SetSelectionTool(selectionTool);
+        doc.Resize();
+        doc.ShowImage();
+
+        window.setWindowTitle(QString("Ducky Shop - %1 (%2/%3)").arg(QString::fromStdString(session.CurrentPath()))
+                              .arg(session.CurrentIndex()+1).arg(session.Count()));
+        strip.setCurrentRow(session.CurrentIndex());
+    };
+
+    // 7.10 Buttons for moving through the session images:
+    QPushButton *btnPrevious = new QPushButton("Previous", &window);
+    btnPrevious->setGeometry(SPACE, currentHeight, BTN_WIDTH/2-SPACE/2, BTN_HEIGHT);
+    // Decoding runs on the pool, the document is shown once it arrives
+    auto openDocument = [&session, &window, &showDocument](int index) {
+        session.OpenLater(index, &window, [&showDocument](bool opened) {
+            if (opened) {
+                showDocument();
+            }
+        });
+    };
+    QObject::connect(btnPrevious, &QPushButton::clicked, [&session, openDocument]() {
+        openDocument(session.CurrentIndex()-1);
+    });
+    QPushButton *btnNext = new QPushButton("Next", &window);
+    btnNext->setGeometry(SPACE+BTN_WIDTH/2+SPACE/2, currentHeight, BTN_WIDTH/2-SPACE/2, BTN_HEIGHT);
+    QObject::connect(btnNext, &QPushButton::clicked, [&session, openDocument]() {
+        openDocument(session.CurrentIndex()+1);
+    });
+    QObject::connect(&strip, &QListWidget::currentRowChanged, [&session, openDocument](int row) {
+        if (row != session.CurrentIndex()) {
+            openDocument(row);
+        }
+    });
+    currentHeight += BTN_ABOVE;
+
+    // 7.11 Button for replaying the current edits over a folder, without blocking the editor:
+    QPushButton *btnBatch = new QPushButton("Batch apply", &window);
+    btnBatch->setGeometry(SPACE, currentHeight, BTN_WIDTH, BTN_HEIGHT);
+    QObject::connect(btnBatch, &QPushButton::clicked, [&session, &window]() {
+        const Recipe &recipe = session.Current().GetRecipe();
+        if (recipe.Empty()) {
+            std::cerr << "Nothing to apply: edit the image first" << std::endl;
+            return;
+        }
+        QString folder = QFileDialog::getExistingDirectory(&window, "Batch apply to folder");
+        if (folder.isEmpty()) {return;}
+
+        BatchWindow *batch = new BatchWindow(recipe, folder.toStdString());
+        batch->setAttribute(Qt::WA_DeleteOnClose);
+        batch->show();
+        batch->Start();
     });
     currentHeight += BTN_ABOVE;
 
 
     // 8. ADJUST AND LAUCH APPLICATION
 
-    if (mainImg.rows < currentHeight+SPACE) {
+    if (mainSize.height < currentHeight+SPACE) {
         windowHeight = currentHeight+SPACE;
     }
     window.setFixedSize(windowWidth, windowHeight);
-    img.SetMinHeight(currentHeight+SPACE);
+    showDocument();
 
     window.show();
+    if (session.Count() > 1) {
+        strip.show();
+    }
     return app.exec();
 }
@@ -0,0 +1,55 @@
+#include "../BufferPool.hpp"
+#include "Check.hpp"
+
+// Uninitialized Mat drawn from pool
+static cv::Mat FromPool(BufferPool &pool, int rows, int cols, int type) {
+    cv::Mat img;
+    img.allocator = &pool;
+    img.create(rows, cols, type);
+    return img;
+}
+
+int main() {
+    BufferPool pool(size_t(64) << 20);
+    size_t fresh;
+    int k;
+
+    // A released buffer is handed back to the next Mat of the same byte size
+    {
+        cv::Mat img = FromPool(pool, 100, 100, CV_8UC3);
+        uchar *data = img.data;
+        img.release();
+        cv::Mat again = FromPool(pool, 100, 100, CV_8UC3);
+        CHECK(again.data == data);
+        CHECK(pool.GetFreshAllocations() == 1);
+        // Recycled buffers still count as allocated
+        CHECK(pool.GetAllocatedBytes() == size_t(2*100*100*3));
+    }
+    CHECK(pool.GetCachedBytes() == size_t(100*100*3));
+
+    // Steady state: interleaved sizes recycle without fresh allocations
+    {
+        cv::Mat a = FromPool(pool, 64, 64, CV_32FC3);
+        cv::Mat b = FromPool(pool, 32, 32, CV_8UC1);
+        a.release();
+        b.release();
+    }
+    fresh = pool.GetFreshAllocations();
+    for (k=0;k<1000;k++) {
+        cv::Mat a = FromPool(pool, 64, 64, CV_32FC3);
+        cv::Mat b = FromPool(pool, 32, 32, CV_8UC1);
+        cv::Mat c = FromPool(pool, 100, 100, CV_8UC3);
+        a.setTo(cv::Scalar::all(k));
+    }
+    CHECK(pool.GetFreshAllocations() == fresh);
+
+    // Nothing beyond the byte cap is kept
+    {
+        BufferPool small(1000);
+        cv::Mat big = FromPool(small, 100, 100, CV_8UC1);
+        big.release();
+        CHECK(small.GetCachedBytes() == 0);
+    }
+
+    return 0;
+}
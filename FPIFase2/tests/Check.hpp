@@ -0,0 +1,24 @@
+#ifndef CHECK_HPP
+#define CHECK_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <cstdlib>
+
+/* Minimal assertions for the test executables, which need OpenCV but no window:
+a failed CHECK prints where it was and exits with a failure for ctest. */
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+        std::exit(1); \
+    } \
+} while (0)
+
+// Same size, type and pixels, for golden outputs
+inline bool SameImage(const cv::Mat &a, const cv::Mat &b) {
+    if (a.dims != b.dims || a.type() != b.type() || a.size != b.size) {return false;}
+    if (a.empty()) {return true;}
+    return cv::norm(a.reshape(1, 1), b.reshape(1, 1), cv::NORM_INF) == 0;
+}
+
+#endif
@@ -0,0 +1,254 @@
+#include "../ImageMatrix.hpp"
+#include "Check.hpp"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+
+// Golden outputs of the kernels on small synthetic images
+
+// 1 x 100 ramp 0..99 of the given channels, grey, alpha 200
+static cv::Mat Ramp(int channels) {
+    cv::Mat img(1, 100, CV_8UC(channels));
+    int j, k;
+
+    for (j=0;j<100;j++) {
+        for (k=0;k<channels;k++) {
+            img.ptr()[j*channels + k] = k == 3 ? 200 : uchar(j);
+        }
+    }
+    return img;
+}
+
+static void TestQuantization() {
+    int channels, j, k;
+
+    // Two shades over 0..99: bins of 50, each mapped to its middle
+    for (channels=1;channels<=4;channels++) {
+        if (channels == 2) {continue;}
+        cv::Mat img = Ramp(channels), out;
+        Quantization(img, out, 2);
+        CHECK(out.type() == img.type());
+        for (j=0;j<100;j++) {
+            for (k=0;k<channels;k++) {
+                uchar expected = k == 3 ? 200 : (j < 50 ? 24 : 74);
+                CHECK(out.ptr()[j*channels + k] == expected);
+            }
+        }
+        // In place gives the same
+        Quantization(img, img, 2);
+        CHECK(SameImage(img, out));
+    }
+
+    // Enough shades for the range leaves the image as it is
+    cv::Mat img = Ramp(3), out;
+    Quantization(img, out, 100);
+    CHECK(SameImage(img, out));
+}
+
+// Grey TIFF of depth holding value, read back as BGR float at full scale 1.0
+static float ReadBack(int depth, double value) {
+    std::string path = (std::filesystem::temp_directory_path() / "ImageMatrixTest.tiff").string();
+    cv::Mat img(4, 4, CV_MAKETYPE(depth, 1), cv::Scalar(value));
+
+    CHECK(cv::imwrite(path, img));
+    cv::Mat read = ReadImage(path);
+    std::filesystem::remove(path);
+    CHECK(read.type() == CV_32FC3);
+    return read.ptr<float>(2)[5];
+}
+
+static void TestReadImage() {
+    // Each depth is scaled from its own range
+    CHECK(std::abs(ReadBack(CV_16S, -32768) - 0) < 1e-6);
+    CHECK(std::abs(ReadBack(CV_16S, 32767) - 1) < 1e-6);
+    CHECK(std::abs(ReadBack(CV_32S, 0) - 0.5) < 1e-6);
+    CHECK(std::abs(ReadBack(CV_64F, 0.25) - 0.25) < 1e-6);
+}
+
+// Rows x columns image of type, 0 left of column edge and value from it on
+static cv::Mat Step(int rows, int columns, int type, int edge, double value) {
+    cv::Mat img(rows, columns, type, cv::Scalar::all(0));
+    img.colRange(edge, columns).setTo(cv::Scalar::all(value));
+    return img;
+}
+
+// Every pixel equals on, in columns listed, and off elsewhere (first channel)
+template <typename T>
+static bool Columns(const cv::Mat &img, std::initializer_list<int> columns, T on, T off) {
+    int i, j;
+
+    for (i=0;i<img.rows;i++) {
+        for (j=0;j<img.cols;j++) {
+            bool listed = std::find(columns.begin(), columns.end(), j) != columns.end();
+            if (img.ptr<T>(i)[j*img.channels()] != (listed ? on : off)) {return false;}
+        }
+    }
+    return true;
+}
+
+static void TestGradient() {
+    cv::Mat out, direction;
+    bool l2;
+
+    // A vertical step is full scale on both sides of it, for either norm, in the vector body and the tail
+    for (l2=false;;l2=true) {
+        Gradient(Step(6, 41, CV_32FC1, 20, 1.0), out, 2, l2);
+        CHECK(out.type() == CV_32FC1);
+        CHECK(Columns<float>(out, {19, 20}, 1.f, 0.f));
+        Gradient(Step(6, 41, CV_8UC1, 20, 255), out, 2, l2);
+        CHECK(Columns<uchar>(out, {19, 20}, 255, 0));
+        if (l2) {break;}
+    }
+
+    // Prewitt, and the direction of a left to right rise is 0
+    Gradient(Step(6, 41, CV_32FC1, 20, 1.0), out, 1, true, cv::BORDER_REPLICATE, false, direction);
+    CHECK(Columns<float>(out, {19, 20}, 1.f, 0.f));
+    CHECK(direction.type() == CV_32FC1 && direction.ptr<float>(3)[19] == 0);
+
+    // Luma mode: a green step gives its luma, truncated, in every colour
+    cv::Mat colour = Step(6, 41, CV_8UC3, 20, 0);
+    colour.colRange(20, 41).setTo(cv::Scalar(0, 255, 0));
+    Gradient(colour, out, 2, false, cv::BORDER_REPLICATE, true);
+    CHECK(out.type() == CV_8UC3);
+    CHECK(Columns<uchar>(out, {19, 20}, 149, 0));
+    CHECK(out.at<cv::Vec3b>(2, 19) == cv::Vec3b(149, 149, 149));
+}
+
+static void TestCanny() {
+    cv::Mat out;
+
+    // Both sides of a step are maxima along the gradient, white on black
+    Canny(Step(32, 32, CV_8UC3, 16, 255), out, 0.1, 0.3);
+    CHECK(out.type() == CV_8UC3);
+    CHECK(Columns<uchar>(out, {15, 16}, 255, 0));
+
+    // A flat image has no edges, a faint step only weak ones, which hysteresis drops
+    Canny(cv::Mat(32, 32, CV_8UC3, cv::Scalar::all(90)), out, 0.1, 0.3);
+    CHECK(cv::countNonZero(out.reshape(1)) == 0);
+    Canny(Step(32, 32, CV_8UC3, 16, 50), out, 0.1, 0.3);
+    CHECK(cv::countNonZero(out.reshape(1)) == 0);
+}
+
+static void TestMedian() {
+    const int radii[] = {1, 2, 7};
+    int channels;
+
+    for (int radius : radii) {
+        for (channels=1;channels<=3;channels+=2) {
+            // Isolated outliers vanish from a flat image
+            cv::Mat flat(20, 300, CV_8UC(channels), cv::Scalar::all(100)), out;
+            flat.at<uchar>(5, 7*channels) = 255;
+            flat.at<uchar>(12, 280*channels) = 0;
+            flat.at<uchar>(0, 0) = 255;
+            Median(flat, out, radius);
+            CHECK(SameImage(out, cv::Mat(20, 300, CV_8UC(channels), cv::Scalar::all(100))));
+
+            // A ramp along the rows is its own median, borders included, across the 256-column tiles
+            cv::Mat ramp(20, 300, CV_8UC(channels));
+            for (int j=0;j<300;j++) {
+                ramp.col(j).setTo(cv::Scalar::all(j*255/299));
+            }
+            Median(ramp, out, radius);
+            CHECK(SameImage(out, ramp));
+        }
+    }
+}
+
+static void TestBilateral() {
+    cv::Mat out;
+    int i, j;
+
+    // Flat stays flat
+    Bilateral(cv::Mat(64, 64, CV_8UC3, cv::Scalar(30, 120, 200)), out, 16, 0.1);
+    CHECK(cv::norm(out, cv::Mat(64, 64, CV_8UC3, cv::Scalar(30, 120, 200)), cv::NORM_INF) <= 1);
+
+    // A step far above the range sigma is kept: neither side bleeds into the other
+    Bilateral(Step(64, 64, CV_8UC3, 32, 255), out, 16, 0.1);
+    for (i=0;i<64;i++) {
+        for (j=0;j<64;j++) {
+            int value = out.at<cv::Vec3b>(i, j)[1];
+            CHECK(j < 32 ? value <= 2 : value >= 253);
+        }
+    }
+}
+
+static void TestSubsample() {
+    cv::Mat img(5, 7, CV_16UC3), planar;
+    int i, j;
+
+    for (i=0;i<5;i++) {
+        for (j=0;j<7;j++) {
+            img.at<cv::Vec3w>(i, j) = cv::Vec3w(ushort(i*10 + j), ushort(1000 + j), ushort(2000 + i));
+        }
+    }
+    // Either layout gives the same interleaved sample, borders rounded up
+    ToPlanar(img, planar);
+    for (const cv::Mat &source : {img, planar}) {
+        cv::Mat sample = Subsample(source, 2);
+        CHECK(sample.rows == 3 && sample.cols == 4 && sample.type() == CV_16UC3);
+        for (i=0;i<3;i++) {
+            for (j=0;j<4;j++) {
+                CHECK(sample.at<cv::Vec3w>(i, j) == img.at<cv::Vec3w>(i*2, j*2));
+            }
+        }
+    }
+}
+
+static void TestTone() {
+    int channels, j;
+
+    // Float rows take the vector body and the scalar tail, alpha is kept and nothing is clamped
+    for (channels=1;channels<=4;channels++) {
+        if (channels == 2) {continue;}
+        cv::Mat img(3, 37, CV_32FC(channels), cv::Scalar::all(0.75)), out;
+        Contrast(img, out, 2.f);
+        Brightness(out, out, 51);
+        for (j=0;j<37*channels;j++) {
+            const float expected = channels == 4 && j % 4 == 3 ? 0.75f : 0.75f*2 + 51 / 255.f;
+            CHECK(std::abs(out.ptr<float>(2)[j] - expected) < 1e-6f);
+        }
+    }
+}
+
+static void TestUnsharp() {
+    cv::Mat out;
+    int i;
+
+    // Flat stays flat
+    cv::Mat flat(200, 64, CV_8UC3, cv::Scalar(30, 120, 200));
+    UnsharpMask(flat, out, 1.0, 2.0, 0.0, cv::BORDER_REFLECT_101);
+    CHECK(SameImage(out, flat));
+
+    // A vertical step overshoots on both sides, the same in every row across stripes, and not far from it
+    cv::Mat step = Step(200, 64, CV_8UC1, 32, 180);
+    step.colRange(0, 32).setTo(60);
+    UnsharpMask(step, out, 1.0, 2.0, 0.0, cv::BORDER_REPLICATE);
+    for (i=0;i<200;i++) {
+        const uchar *row = out.ptr(i);
+        CHECK(row[31] < 60 && row[32] > 180);
+        CHECK(row[0] == 60 && row[63] == 180);
+        CHECK(std::equal(row, row + 64, out.ptr(0)));
+    }
+
+    // The same boxes run both ways, so a horizontal step sharpens like a vertical one
+    cv::Mat turned;
+    UnsharpMask(step.t(), turned, 1.0, 2.0, 0.0, cv::BORDER_REPLICATE);
+    CHECK(cv::norm(turned, cv::Mat(out.t()), cv::NORM_INF) <= 1);
+
+    // Detail below the threshold is left alone
+    UnsharpMask(step, out, 1.0, 2.0, 1.0, cv::BORDER_REPLICATE);
+    CHECK(SameImage(out, step));
+}
+
+int main() {
+    TestQuantization();
+    TestReadImage();
+    TestGradient();
+    TestCanny();
+    TestMedian();
+    TestBilateral();
+    TestSubsample();
+    TestTone();
+    TestUnsharp();
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "../Recipe.hpp"
+#include "../ImageMatrix.hpp"
+#include "Check.hpp"
+#include <cmath>
+
+// Selections replayed on images of another size, as the batch does
+
+// Width x height gradient, every pixel different
+static cv::Mat Pattern(int width, int height) {
+    cv::Mat img(height, width, CV_8UC3);
+    int i, j;
+
+    for (i=0;i<height;i++) {
+        for (j=0;j<width;j++) {
+            img.at<cv::Vec3b>(i, j) = cv::Vec3b(uchar(i*7), uchar(j*5), uchar(i+j));
+        }
+    }
+    return img;
+}
+
+int main() {
+    const cv::Rect selection(10, 10, 30, 30);
+    cv::Mat lasso = cv::Mat::zeros(selection.size(), CV_8U);
+    int i, j;
+
+    // Lower-left triangle of the selection
+    for (i=0;i<selection.height;i++) {
+        for (j=0;j<=i;j++) {
+            lasso.at<uchar>(i, j) = 255;
+        }
+    }
+
+    // A lasso step replayed on an image that cuts the selection
+    {
+        Recipe recipe;
+        recipe.SetRegion(selection, lasso);
+        recipe.Add(Recipe::Negative);
+
+        cv::Mat img = Pattern(25, 20), out;
+        recipe.Apply(img, out);
+        CHECK(out.size() == img.size());
+        for (i=0;i<img.rows;i++) {
+            for (j=0;j<img.cols;j++) {
+                bool inside = selection.contains(cv::Point(j, i)) && lasso.at<uchar>(i-10, j-10);
+                cv::Vec3b expected = img.at<cv::Vec3b>(i, j);
+                if (inside) {
+                    expected = cv::Vec3b(255, 255, 255) - expected;
+                }
+                CHECK(out.at<cv::Vec3b>(i, j) == expected);
+            }
+        }
+    }
+
+    // A neighbourhood kernel under a rectangle, replayed past the image edge
+    {
+        Recipe recipe;
+        const double blur[3][3] = {{1/9.0, 1/9.0, 1/9.0}, {1/9.0, 1/9.0, 1/9.0}, {1/9.0, 1/9.0, 1/9.0}};
+        recipe.SetRegion(selection, cv::Mat());
+        recipe.AddFilter(blur, false, cv::BORDER_REPLICATE, false);
+
+        cv::Mat img = Pattern(15, 15), out;
+        recipe.Apply(img, out);
+        CHECK(out.size() == img.size());
+        // Pixels outside the clipped selection are untouched
+        for (i=0;i<img.rows;i++) {
+            for (j=0;j<img.cols;j++) {
+                if (i < 10 || j < 10) {
+                    CHECK(out.at<cv::Vec3b>(i, j) == img.at<cv::Vec3b>(i, j));
+                }
+            }
+        }
+    }
+
+    // A selection entirely outside the image leaves it as it is
+    {
+        Recipe recipe;
+        recipe.SetRegion(selection, lasso);
+        recipe.Add(Recipe::Negative);
+
+        cv::Mat img = Pattern(8, 8), out;
+        recipe.Apply(img, out);
+        CHECK(SameImage(img, out));
+    }
+
+    // Repeated tone changes of one selection replace each other
+    {
+        Recipe recipe;
+        recipe.SetRegion(cv::Rect(0, 0, 4, 4), cv::Mat());
+        recipe.SetRegionTone(20, 1);
+        recipe.SetRegionTone(30, 1);
+
+        cv::Mat img(8, 8, CV_8UC3, cv::Scalar::all(100)), out;
+        recipe.Apply(img, out);
+        CHECK(out.at<cv::Vec3b>(1, 1) == cv::Vec3b(130, 130, 130));
+        CHECK(out.at<cv::Vec3b>(6, 6) == cv::Vec3b(100, 100, 100));
+    }
+
+    // 8-bit input is edited at the working depth, without rounding between steps
+    {
+        Recipe recipe;
+        recipe.SetWorkingDepth(CV_32F);
+        recipe.SetContrast(0.5f);
+
+        cv::Mat img(8, 8, CV_8UC3, cv::Scalar::all(101)), out;
+        recipe.Apply(img, out);
+        CHECK(out.depth() == CV_32F);
+        CHECK(std::abs(out.at<cv::Vec3f>(3, 3)[0] - 101 * 0.5f / 255) < 1e-5f);
+    }
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "../ThumbnailCache.hpp"
+#include "Check.hpp"
+
+// JPEG headers built byte by byte, valid and crafted to break the parser's bounds
+
+static void Put16(std::vector<uchar> &bytes, unsigned value, bool little) {
+    if (little) {
+        bytes.push_back(uchar(value));
+        bytes.push_back(uchar(value >> 8));
+    } else {
+        bytes.push_back(uchar(value >> 8));
+        bytes.push_back(uchar(value));
+    }
+}
+
+static void Put32(std::vector<uchar> &bytes, unsigned value) {
+    Put16(bytes, value & 0xFFFF, true);
+    Put16(bytes, value >> 16, true);
+}
+
+static void PutEntry(std::vector<uchar> &tiff, unsigned tag, unsigned type, unsigned value) {
+    Put16(tiff, tag, true);
+    Put16(tiff, type, true);
+    Put32(tiff, 1);
+    Put32(tiff, value);
+}
+
+/* Little-endian TIFF block: IFD0 with the orientation, IFD1 pointing at an encoded
+thumbnail. ifd0, ifd1, offset and length replace the real values when not zero. */
+static std::vector<uchar> Tiff(const std::vector<uchar> &thumbnail, unsigned orientation,
+                               unsigned ifd0 = 0, unsigned ifd1 = 0, unsigned offset = 0, unsigned length = 0) {
+    const unsigned firstIfd = 8, secondIfd = firstIfd + 2 + 12 + 4, data = secondIfd + 2 + 2*12 + 4;
+    std::vector<uchar> tiff = {'I', 'I', 42, 0};
+
+    Put32(tiff, ifd0 ? ifd0 : firstIfd);
+    Put16(tiff, 1, true);
+    PutEntry(tiff, 0x0112, 3, orientation);
+    Put32(tiff, ifd1 ? ifd1 : secondIfd);
+    Put16(tiff, 2, true);
+    PutEntry(tiff, 0x0201, 4, offset ? offset : data);
+    PutEntry(tiff, 0x0202, 4, length ? length : unsigned(thumbnail.size()));
+    Put32(tiff, 0);
+    tiff.insert(tiff.end(), thumbnail.begin(), thumbnail.end());
+    return tiff;
+}
+
+// SOI, APP1 with tiff, then a baseline frame header of width x height
+static std::vector<uchar> Jpeg(const std::vector<uchar> &tiff, int width, int height) {
+    std::vector<uchar> bytes = {0xFF, 0xD8, 0xFF, 0xE1};
+    const char exif[6] = {'E', 'x', 'i', 'f', 0, 0};
+
+    Put16(bytes, unsigned(2 + 6 + tiff.size()), false);
+    bytes.insert(bytes.end(), exif, exif+6);
+    bytes.insert(bytes.end(), tiff.begin(), tiff.end());
+    bytes.push_back(0xFF);
+    bytes.push_back(0xC0);
+    Put16(bytes, 17, false);
+    bytes.push_back(8);
+    Put16(bytes, unsigned(height), false);
+    Put16(bytes, unsigned(width), false);
+    bytes.insert(bytes.end(), 12, 0);
+    return bytes;
+}
+
+static void Parse(const std::vector<uchar> &bytes, cv::Mat &exif, cv::Size &size) {
+    exif.release();
+    size = cv::Size();
+    ParseJpeg(bytes, exif, size);
+}
+
+int main() {
+    std::vector<uchar> thumbnail;
+    cv::Mat exif;
+    cv::Size size;
+    size_t cut;
+
+    CHECK(cv::imencode(".jpg", cv::Mat(8, 16, CV_8UC3, cv::Scalar(40, 120, 200)), thumbnail));
+
+    // Valid header: thumbnail and frame size
+    Parse(Jpeg(Tiff(thumbnail, 1), 640, 480), exif, size);
+    CHECK(size == cv::Size(640, 480));
+    CHECK(exif.size() == cv::Size(16, 8));
+
+    // Orientation 6 turns the thumbnail upright
+    Parse(Jpeg(Tiff(thumbnail, 6), 640, 480), exif, size);
+    CHECK(exif.size() == cv::Size(8, 16));
+
+    // Offsets that wrap around 32 bits are rejected, the frame size is still found
+    Parse(Jpeg(Tiff(thumbnail, 1, 0xFFFFFFFF), 640, 480), exif, size);
+    CHECK(exif.empty() && size == cv::Size(640, 480));
+    Parse(Jpeg(Tiff(thumbnail, 1, 0, 0xFFFFFFFE), 640, 480), exif, size);
+    CHECK(exif.empty() && size == cv::Size(640, 480));
+    Parse(Jpeg(Tiff(thumbnail, 1, 0, 0, 60, 0xFFFFFFF0), 640, 480), exif, size);
+    CHECK(exif.empty() && size == cv::Size(640, 480));
+    Parse(Jpeg(Tiff(thumbnail, 1, 0, 0, 0xFFFFFF00, 0x200), 640, 480), exif, size);
+    CHECK(exif.empty() && size == cv::Size(640, 480));
+
+    // Segment lengths shorter than their own two bytes end the scan
+    Parse({0xFF, 0xD8, 0xFF, 0xE1, 0x00, 0x00, 0xFF, 0xC0}, exif, size);
+    CHECK(exif.empty() && size == cv::Size());
+    Parse({0xFF, 0xD8, 0xFF, 0xE1, 0x00, 0x01, 0xFF, 0xC0}, exif, size);
+    CHECK(exif.empty() && size == cv::Size());
+
+    // Headers cut anywhere never read past their end
+    std::vector<uchar> whole = Jpeg(Tiff(thumbnail, 1), 640, 480);
+    for (cut=0;cut<whole.size();cut++) {
+        Parse(std::vector<uchar>(whole.begin(), whole.begin() + cut), exif, size);
+    }
+
+    return 0;
+}